@@ -0,0 +1,529 @@
+/*******************************************************************************
+* DiscoNode bus bootloader
+*
+* Lives in the 4KB boot section and flashes the application with pages that
+* the master broadcasts over the RS485 bus, so every node on the floor is
+* updated at the same time. See MultidropBoot.h for the protocol.
+*
+* Updates can also be sent as a patch against the image the node is running.
+* If our flash matches the patch's base image, we only ask for the changed
+* pages; otherwise we ask for every page, like a full update.
+*
+* This is a small, polled, version of the multidrop slave: it only understands
+* plain and range batch messages (no class batches or addressing), and always
+* runs at 250K baud. The node address is the one the firmware saved in its
+* config block (see config.h).
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "Multidrop.h"
+#include "MultidropBoot.h"
+#include "config.h"
+
+#define BAUD 250000
+
+// RS485 driver enable
+#define DE_DDR  DDRD
+#define DE_PORT PORTD
+#define DE_PIN  PD2
+
+// Where older firmware saved our bus address, before the config block
+#define OLD_EEPROM_HAS_ADDR (uint8_t*)0
+#define OLD_EEPROM_ADDR     (uint8_t*)1
+#define OLD_EEPROM_ADDR_HI  (uint8_t*)10
+
+#define SOM 0xFF
+
+// CMD_BOOT_PAGE data: page number, page CRC, page
+#define PAGE_HEADER_LEN 3
+#define RX_BUFFER_LEN   (PAGE_HEADER_LEN + BOOT_PAGE_SIZE)
+
+#if BOOT_PATCH_HEADER_LEN > RX_BUFFER_LEN
+#error "The receive buffer is too small for the patch header"
+#endif
+
+// Bytes of a written page to check against its CRC, each time through the loop
+#define VERIFY_STEP 16
+
+// Message parse states
+enum {
+  WAIT_SOM1,
+  WAIT_SOM2,
+  HEADER,
+  DATA,
+  CRC_HI,
+  CRC_LO
+};
+
+// Header fields
+enum {
+  FIELD_FLAGS,
+  FIELD_ADDR_HI,
+  FIELD_ADDR,
+  FIELD_CMD,
+  FIELD_NODES_HI,
+  FIELD_NODES,
+  FIELD_LEN
+};
+
+// Page write states
+enum {
+  WRITE_IDLE,
+  WRITE_ERASING,
+  WRITE_WRITING,
+  WRITE_VERIFYING
+};
+
+static uint16_t my_address = 0;
+
+// Current message
+static uint8_t  state = WAIT_SOM1,
+                field,
+                flags,
+                command,
+                length,
+                for_me,
+                responding;
+static uint16_t address,
+                nodes,
+                crc;
+static uint32_t data_len,
+                data_index,
+                data_offset;
+
+// Our data from the current message
+static uint8_t  rx_buffer[RX_BUFFER_LEN];
+static uint8_t  rx_len;
+static uint16_t rx_page_crc;
+
+// Update state
+static uint8_t  boot_state = BOOT_IDLE,
+                image_pages;
+static uint16_t image_crc;
+static uint8_t  missing[BOOT_MAX_PAGES / 8];
+
+// Page being written to flash
+static uint8_t  write_state = WRITE_IDLE,
+                write_page,
+                verify_index;
+static uint16_t write_crc,
+                verify_crc;
+static uint8_t  write_buffer[BOOT_PAGE_SIZE];
+
+/**
+ * Jump to the application.
+ */
+static void start_app() {
+  UCSR0B = 0;
+  DE_DDR &= ~(1 << DE_PIN);
+  ((void (*)())0)();
+}
+
+/**
+ * The bus address the firmware saved (0 if there isn't one).
+ */
+static uint16_t saved_address() {
+  config_t config;
+  uint8_t *b = (uint8_t*)&config;
+  uint16_t c = ~0;
+
+  eeprom_read_block(&config, CONFIG_EEPROM_ADDR, sizeof(config));
+  for (uint8_t i = 0; i < offsetof(config_t, crc); i++) {
+    c = _crc16_update(c, b[i]);
+  }
+  if (config.version == CONFIG_VERSION && config.size == sizeof(config) && config.crc == c) {
+    return config.address;
+  }
+
+  // Older firmware
+  uint8_t has_addr = eeprom_read_byte(OLD_EEPROM_HAS_ADDR);
+  if (has_addr == 1) {
+    return eeprom_read_byte(OLD_EEPROM_ADDR);
+  }
+  if (has_addr == 2) {
+    return eeprom_read_byte(OLD_EEPROM_ADDR) | (eeprom_read_byte(OLD_EEPROM_ADDR_HI) << 8);
+  }
+  return 0;
+}
+
+/**
+ * Send a byte on the bus (the driver must already be enabled).
+ */
+static void uart_write(uint8_t b) {
+  while (!(UCSR0A & (1 << UDRE0)));
+  UDR0 = b;
+  UCSR0A |= (1 << TXC0);
+}
+
+/**
+ * Is a page still missing
+ */
+static uint8_t is_missing(uint8_t page) {
+  return missing[page >> 3] & (1 << (page & 0x07));
+}
+
+/**
+ * Byte `i` of our CMD_BOOT_STATUS response.
+ */
+static uint8_t status_byte(uint8_t i) {
+  if (i == 0) return boot_state;
+  if (i - 1 < (uint8_t)sizeof(missing)) return missing[i - 1];
+  return 0;
+}
+
+/**
+ * Send our slot of a response message.
+ */
+static void send_response() {
+  uint8_t b;
+
+  // Make sure we're not butting up against the last byte received
+  _delay_us(150);
+
+  DE_PORT |= (1 << DE_PIN);
+  for (uint8_t i = 0; i < length; i++) {
+    b = (command == CMD_BOOT_STATUS) ? status_byte(i) : 0;
+    uart_write(b);
+    crc = _crc16_update(crc, b);
+  }
+  while (!(UCSR0A & (1 << TXC0)));
+  DE_PORT &= ~(1 << DE_PIN);
+
+  data_index += length;
+}
+
+/**
+ * The header is done, figure out which part of the data is ours.
+ */
+static void start_data() {
+  uint16_t first = 1;
+
+  data_index = 0;
+  data_offset = 0;
+  rx_len = 0;
+  rx_page_crc = ~0;
+
+  if (flags & Multidrop::BATCH_FLAG) {
+    data_len = (uint32_t)length * nodes;
+
+    // Range messages start at the header address
+    if ((flags & Multidrop::RANGE_FLAG) && address != Multidrop::BROADCAST_ADDRESS) {
+      first = address;
+    }
+    for_me = (my_address >= first && my_address - first < nodes);
+    data_offset = (uint32_t)(my_address - first) * length;
+    responding = for_me && (flags & Multidrop::RESPONSE_MESSAGE_FLAG);
+  } else {
+    data_len = length;
+    for_me = (address == Multidrop::BROADCAST_ADDRESS || address == my_address);
+    responding = (address == my_address && my_address && (flags & Multidrop::RESPONSE_MESSAGE_FLAG));
+  }
+
+  if (data_len == 0) {
+    state = CRC_HI;
+  } else {
+    state = DATA;
+    if (responding && data_offset == 0) {
+      send_response();
+    }
+  }
+}
+
+static void parse_header(uint8_t b) {
+  uint8_t ext = flags & Multidrop::EXT_FLAG;
+
+  switch (field) {
+    case FIELD_FLAGS:
+      flags = b;
+      address = 0;
+      nodes = 0;
+
+      // We can't size class batch messages, wait for the next one
+      if (flags & Multidrop::CLASS_FLAG) {
+        state = WAIT_SOM1;
+      }
+      field = (flags & Multidrop::EXT_FLAG) ? FIELD_ADDR_HI : FIELD_ADDR;
+    break;
+    case FIELD_ADDR_HI:
+      address = b << 8;
+      field = FIELD_ADDR;
+    break;
+    case FIELD_ADDR:
+      address |= b;
+      field = FIELD_CMD;
+    break;
+    case FIELD_CMD:
+      command = b;
+      if (flags & Multidrop::BATCH_FLAG) {
+        field = (ext) ? FIELD_NODES_HI : FIELD_NODES;
+      } else {
+        field = FIELD_LEN;
+      }
+
+      // Addressing doesn't use the normal message layout
+      if (command == CMD_ADDRESS) {
+        state = WAIT_SOM1;
+      }
+    break;
+    case FIELD_NODES_HI:
+      nodes = b << 8;
+      field = FIELD_NODES;
+    break;
+    case FIELD_NODES:
+      nodes |= b;
+      field = FIELD_LEN;
+    break;
+    case FIELD_LEN:
+      length = b;
+      start_data();
+    break;
+  }
+}
+
+static void parse_data(uint8_t b) {
+
+  // Save our part of the data
+  if (for_me && !responding && data_index >= data_offset &&
+      rx_len < length && rx_len < RX_BUFFER_LEN) {
+
+    // Page CRC is calculated as it comes in
+    if (rx_len >= PAGE_HEADER_LEN) {
+      rx_page_crc = _crc16_update(rx_page_crc, b);
+    }
+    rx_buffer[rx_len++] = b;
+  }
+  data_index++;
+
+  // Our turn to respond
+  if (responding && data_index == data_offset) {
+    send_response();
+  }
+
+  if (data_index >= data_len) {
+    state = CRC_HI;
+  }
+}
+
+/**
+ * We're done once no pages are missing.
+ */
+static void update_state() {
+  boot_state = BOOT_DONE;
+  for (uint8_t i = 0; i < sizeof(missing); i++) {
+    if (missing[i]) boot_state = BOOT_RECEIVING;
+  }
+}
+
+/**
+ * Mark the first `pages` pages as missing.
+ */
+static void set_all_missing(uint8_t pages) {
+  memset(missing, 0, sizeof(missing));
+  for (uint8_t i = 0; i < pages; i++) {
+    missing[i >> 3] |= (1 << (i & 0x07));
+  }
+}
+
+/**
+ * Start writing a received page to flash. Erasing and writing run in the
+ * background (the application section is RWW), so we keep reading the bus.
+ */
+static void write_start() {
+  if (write_state != WRITE_IDLE) return; // Busy, the master will send it again
+
+  write_page = rx_buffer[0];
+  write_crc = (rx_buffer[1] << 8) | rx_buffer[2];
+  memcpy(write_buffer, &rx_buffer[PAGE_HEADER_LEN], BOOT_PAGE_SIZE);
+
+  boot_page_erase((uint16_t)write_page * BOOT_PAGE_SIZE);
+  write_state = WRITE_ERASING;
+}
+
+/**
+ * Move the page write along, whenever the flash is ready.
+ */
+static void write_run() {
+  uint16_t addr = (uint16_t)write_page * BOOT_PAGE_SIZE;
+
+  if (write_state == WRITE_IDLE || boot_spm_busy()) return;
+
+  if (write_state == WRITE_ERASING) {
+    for (uint8_t i = 0; i < BOOT_PAGE_SIZE; i += 2) {
+      boot_page_fill(addr + i, write_buffer[i] | (write_buffer[i + 1] << 8));
+    }
+    boot_page_write(addr);
+    write_state = WRITE_WRITING;
+  }
+  else if (write_state == WRITE_WRITING) {
+    boot_rww_enable();
+    verify_index = 0;
+    verify_crc = ~0;
+    write_state = WRITE_VERIFYING;
+  }
+
+  // Read back the page, a few bytes at a time, so we don't miss bus data
+  else if (write_state == WRITE_VERIFYING) {
+    for (uint8_t i = 0; i < VERIFY_STEP; i++, verify_index++) {
+      verify_crc = _crc16_update(verify_crc, pgm_read_byte(addr + verify_index));
+    }
+    if (verify_index < BOOT_PAGE_SIZE) return;
+
+    if (verify_crc == write_crc) {
+      missing[write_page >> 3] &= ~(1 << (write_page & 0x07));
+    }
+    write_state = WRITE_IDLE;
+    update_state();
+  }
+}
+
+/**
+ * CRC of the first `pages` pages in flash
+ */
+static uint16_t flash_crc(uint8_t pages) {
+  uint16_t c = ~0;
+  uint16_t len = (uint16_t)pages * BOOT_PAGE_SIZE;
+
+  for (uint16_t i = 0; i < len; i++) {
+    c = _crc16_update(c, pgm_read_byte(i));
+  }
+  return c;
+}
+
+/**
+ * Act on a valid message.
+ */
+static void handle_message() {
+  if (!for_me || responding) return;
+
+  switch (command) {
+    // New image: number of pages, image CRC
+    case CMD_BOOT_START:
+      if (rx_len < 3) return;
+
+      image_pages = rx_buffer[0];
+      image_crc = (rx_buffer[1] << 8) | rx_buffer[2];
+
+      if (image_pages == 0 || image_pages > BOOT_MAX_PAGES) {
+        boot_state = BOOT_ERROR;
+        return;
+      }
+      set_all_missing(image_pages);
+      boot_state = BOOT_RECEIVING;
+    break;
+
+    // New image, as a patch: number of pages, image CRC, base pages, base CRC, changed pages
+    case CMD_BOOT_PATCH:
+      if (rx_len < BOOT_PATCH_HEADER_LEN) return;
+
+      image_pages = rx_buffer[0];
+      image_crc = (rx_buffer[1] << 8) | rx_buffer[2];
+
+      if (image_pages == 0 || image_pages > BOOT_MAX_PAGES || rx_buffer[3] > BOOT_MAX_PAGES) {
+        boot_state = BOOT_ERROR;
+        return;
+      }
+
+      // Only the changed pages if we're running the base image, otherwise all of them
+      set_all_missing(image_pages);
+      if (flash_crc(rx_buffer[3]) == ((rx_buffer[4] << 8) | rx_buffer[5])) {
+        for (uint8_t i = 0; i < sizeof(missing); i++) {
+          missing[i] &= rx_buffer[6 + i];
+        }
+      }
+      update_state();
+    break;
+
+    // Page of the image, if we still need it and it's intact
+    case CMD_BOOT_PAGE:
+      if (boot_state == BOOT_RECEIVING &&
+          rx_len == RX_BUFFER_LEN &&
+          rx_buffer[0] < image_pages &&
+          is_missing(rx_buffer[0]) &&
+          rx_page_crc == ((rx_buffer[1] << 8) | rx_buffer[2])) {
+        write_start();
+      }
+    break;
+
+    // Check the whole image and run it
+    case CMD_BOOT_FINISH:
+      if (boot_state != BOOT_DONE) return;
+
+      if (flash_crc(image_pages) == image_crc) {
+        eeprom_update_byte(BOOT_EEPROM_FLAG, 0xFF);
+        start_app();
+      }
+      boot_state = BOOT_ERROR;
+    break;
+  }
+}
+
+static void parse(uint8_t b) {
+  switch (state) {
+    case WAIT_SOM1:
+      if (b == SOM) state = WAIT_SOM2;
+    break;
+    case WAIT_SOM2:
+      if (b == SOM) {
+        state = HEADER;
+        field = FIELD_FLAGS;
+        crc = ~0;
+      } else {
+        state = WAIT_SOM1;
+      }
+    break;
+    case HEADER:
+      crc = _crc16_update(crc, b);
+      parse_header(b);
+    break;
+    case DATA:
+      crc = _crc16_update(crc, b);
+      parse_data(b);
+    break;
+    case CRC_HI:
+      state = (b == (crc >> 8)) ? CRC_LO : WAIT_SOM1;
+    break;
+    case CRC_LO:
+      state = WAIT_SOM1;
+      if (b == (crc & 0xFF)) {
+        handle_message();
+      }
+    break;
+  }
+}
+
+int main() {
+
+  // Run the application, unless it asked for an update or there isn't one
+  if (eeprom_read_byte(BOOT_EEPROM_FLAG) != BOOT_FLAG_UPDATE && pgm_read_word(0) != 0xFFFF) {
+    start_app();
+  }
+
+  // The application restarts us with the watchdog
+  MCUSR = 0;
+  wdt_disable();
+
+  my_address = saved_address();
+
+  // Bus
+  DE_DDR |= (1 << DE_PIN);
+  DE_PORT &= ~(1 << DE_PIN);
+  UBRR0 = (F_CPU / 16 / BAUD) - 1;
+  UCSR0B = (1 << RXEN0) | (1 << TXEN0);
+  UCSR0C = (1 << UCSZ01) | (1 << UCSZ00); // 8N1
+
+  while (1) {
+    if (UCSR0A & (1 << RXC0)) {
+      parse(UDR0);
+    }
+    write_run();
+  }
+}
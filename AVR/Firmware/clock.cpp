@@ -30,6 +30,28 @@ volatile uint16_t millis() {
   }
 }
 
+/**
+ * Returns the current time in microseconds.
+ * The resolution is one timer 2 tick (12.8us at 20MHz).
+ */
+uint16_t micros() {
+  uint16_t ms;
+  uint8_t ticks;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    ms = current_time;
+    ticks = TCNT2;
+
+    // The timer has rolled over, but the interrupt hasn't run yet
+    if ((TIFR2 & (1 << OCF2A)) && ticks < OCR2A) {
+      ms++;
+    }
+  }
+
+  // Each tick is 256 / F_CPU seconds
+  return (ms * 1000) + (uint16_t)((ticks * (256000000UL / (F_CPU / 100))) / 100);
+}
+
 /**
  * Interrupt to keep the current time in milliseconds.
  */
@@ -12,4 +12,7 @@ void start_clock();
 // Return the current millisecond count
 volatile uint16_t millis();
 
+// Return the current microsecond count (wraps every ~65ms, so only use it to time short things)
+uint16_t micros();
+
 #endif
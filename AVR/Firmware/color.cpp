@@ -0,0 +1,117 @@
+/*******************************************************************************
+* Color
+*
+* Gamma, white balance and dimming applied to every color before it reaches
+* the LEDs.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "color.h"
+#include "pwm.h"
+
+// 8-bit to 16-bit gamma table (gamma 2.2)
+static const uint16_t gamma_table[256] PROGMEM = {
+  0x0000, 0x0000, 0x0002, 0x0004, 0x0007, 0x000B, 0x0011, 0x0018,
+  0x0020, 0x002A, 0x0035, 0x0041, 0x004F, 0x005E, 0x006F, 0x0081,
+  0x0094, 0x00A9, 0x00C0, 0x00D8, 0x00F2, 0x010E, 0x012B, 0x014A,
+  0x016A, 0x018C, 0x01B0, 0x01D5, 0x01FC, 0x0225, 0x024F, 0x027B,
+  0x02A9, 0x02D9, 0x030B, 0x033E, 0x0373, 0x03AA, 0x03E3, 0x041D,
+  0x0459, 0x0497, 0x04D7, 0x0519, 0x055D, 0x05A3, 0x05EA, 0x0633,
+  0x067F, 0x06CC, 0x071B, 0x076C, 0x07BF, 0x0814, 0x086B, 0x08C3,
+  0x091E, 0x097B, 0x09D9, 0x0A3A, 0x0A9D, 0x0B01, 0x0B68, 0x0BD0,
+  0x0C3B, 0x0CA8, 0x0D16, 0x0D87, 0x0DFA, 0x0E6E, 0x0EE5, 0x0F5E,
+  0x0FD9, 0x1056, 0x10D5, 0x1156, 0x11DA, 0x125F, 0x12E6, 0x1370,
+  0x13FB, 0x1489, 0x1519, 0x15AB, 0x163F, 0x16D5, 0x176E, 0x1808,
+  0x18A5, 0x1944, 0x19E5, 0x1A88, 0x1B2D, 0x1BD4, 0x1C7E, 0x1D2A,
+  0x1DD8, 0x1E88, 0x1F3A, 0x1FEF, 0x20A6, 0x215F, 0x221A, 0x22D7,
+  0x2397, 0x2459, 0x251D, 0x25E3, 0x26AC, 0x2776, 0x2843, 0x2913,
+  0x29E4, 0x2AB8, 0x2B8E, 0x2C66, 0x2D41, 0x2E1E, 0x2EFD, 0x2FDE,
+  0x30C2, 0x31A8, 0x3290, 0x337B, 0x3468, 0x3557, 0x3648, 0x373C,
+  0x3832, 0x392B, 0x3A25, 0x3B22, 0x3C22, 0x3D24, 0x3E28, 0x3F2E,
+  0x4037, 0x4142, 0x424F, 0x435F, 0x4471, 0x4586, 0x469D, 0x47B6,
+  0x48D2, 0x49F0, 0x4B10, 0x4C33, 0x4D58, 0x4E7F, 0x4FA9, 0x50D6,
+  0x5204, 0x5335, 0x5469, 0x559F, 0x56D7, 0x5812, 0x594F, 0x5A8E,
+  0x5BD0, 0x5D15, 0x5E5C, 0x5FA5, 0x60F1, 0x623F, 0x638F, 0x64E2,
+  0x6638, 0x6790, 0x68EA, 0x6A47, 0x6BA6, 0x6D08, 0x6E6C, 0x6FD3,
+  0x713C, 0x72A7, 0x7415, 0x7586, 0x76F9, 0x786E, 0x79E6, 0x7B61,
+  0x7CDE, 0x7E5D, 0x7FDF, 0x8164, 0x82EA, 0x8474, 0x8600, 0x878E,
+  0x891F, 0x8AB3, 0x8C49, 0x8DE1, 0x8F7C, 0x911A, 0x92BA, 0x945D,
+  0x9602, 0x97A9, 0x9954, 0x9B00, 0x9CB0, 0x9E62, 0xA016, 0xA1CD,
+  0xA386, 0xA542, 0xA701, 0xA8C2, 0xAA86, 0xAC4C, 0xAE15, 0xAFE1,
+  0xB1AF, 0xB37F, 0xB552, 0xB728, 0xB900, 0xBADB, 0xBCB9, 0xBE99,
+  0xC07B, 0xC261, 0xC449, 0xC633, 0xC820, 0xCA10, 0xCC02, 0xCDF7,
+  0xCFEE, 0xD1E8, 0xD3E5, 0xD5E4, 0xD7E6, 0xD9EB, 0xDBF2, 0xDDFC,
+  0xE008, 0xE217, 0xE429, 0xE63D, 0xE854, 0xEA6E, 0xEC8A, 0xEEA9,
+  0xF0CA, 0xF2EE, 0xF515, 0xF73F, 0xF96B, 0xFB9A, 0xFDCB, 0xFFFF
+};
+
+static uint8_t use_gamma = 0;
+static uint8_t gains[3] = { COLOR_GAIN_FULL, COLOR_GAIN_FULL, COLOR_GAIN_FULL };
+static uint8_t dimmer = 0xFF;
+
+// The last linear color, before white balance and dimming
+static uint16_t linear[3] = { 0, 0, 0 };
+
+/**
+ * Send the linear color through white balance and the dimmer, to the LEDs.
+ */
+static void color_output() {
+  uint16_t out[3];
+  uint8_t i;
+
+  for (i = 0; i < 3; i++) {
+    uint32_t scale = (uint32_t)(gains[i] + 1) * (dimmer + 1);
+    out[i] = ((uint32_t)linear[i] * scale) >> 16;
+  }
+  pwm_rgb16(out[0], out[1], out[2]);
+}
+
+void color_init(uint8_t gamma_enabled, uint8_t *white_balance) {
+  use_gamma = gamma_enabled;
+  color_set_white_balance(white_balance);
+}
+
+void color_set(uint8_t *rgb) {
+  uint8_t i;
+
+  // Gamma spreads the darkest steps below one 8-bit step, so they need 12-bit
+  // output. Without it, 8 bits is all there is and the dithering interrupt
+  // (see pwm.h) isn't worth running.
+  pwm_set_resolution(use_gamma ? PWM_12BIT : PWM_8BIT);
+
+  for (i = 0; i < 3; i++) {
+    if (use_gamma) {
+      linear[i] = pgm_read_word(&gamma_table[rgb[i]]);
+    } else {
+      linear[i] = ((uint16_t)rgb[i] << 8) | rgb[i];
+    }
+  }
+  color_output();
+}
+
+void color_set16(uint16_t red, uint16_t green, uint16_t blue) {
+  pwm_set_resolution(PWM_12BIT);
+
+  linear[0] = red;
+  linear[1] = green;
+  linear[2] = blue;
+  color_output();
+}
+
+void color_set_gamma(uint8_t enabled) {
+  use_gamma = enabled;
+}
+
+void color_set_white_balance(uint8_t *wb) {
+  gains[0] = wb[0];
+  gains[1] = wb[1];
+  gains[2] = wb[2];
+  color_output();
+}
+
+void color_set_dimmer(uint8_t level) {
+  dimmer = level;
+  color_output();
+}
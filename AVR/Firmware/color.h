@@ -0,0 +1,37 @@
+/**
+ * The color pipeline between the colors the master sends and the PWM outputs:
+ *
+ *  1. Gamma correction (8-bit colors only, off by default), so brightness steps
+ *     look even. Gamma corrected and 16-bit colors are shown with 12-bit output,
+ *     other 8-bit colors with 8-bit output.
+ *  2. Per-node white balance gains, to even out the tint of each node's LEDs.
+ *  3. A master dimmer shared by the whole floor.
+ */
+
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdint.h>
+
+// Gain value that leaves a channel unchanged
+#define COLOR_GAIN_FULL 0xFF
+
+// Setup the pipeline
+void color_init(uint8_t gamma_enabled, uint8_t *white_balance);
+
+// Display an 8-bit color (gamma corrected, if enabled)
+void color_set(uint8_t *rgb);
+
+// Display a linear 16-bit color (no gamma correction)
+void color_set16(uint16_t red, uint16_t green, uint16_t blue);
+
+// Turn gamma correction on or off
+void color_set_gamma(uint8_t enabled);
+
+// Set the red, green and blue gains (COLOR_GAIN_FULL = no change)
+void color_set_white_balance(uint8_t *gains);
+
+// Set the master brightness (0xFF = full)
+void color_set_dimmer(uint8_t level);
+
+#endif
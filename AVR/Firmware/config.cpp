@@ -0,0 +1,93 @@
+/*******************************************************************************
+* Config
+*
+* Before the config block, each setting had its own EEPROM byte. Nodes
+* upgraded from that firmware have no block yet, so their settings are
+* read from the old bytes once and saved as a block.
+******************************************************************************/
+
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include "config.h"
+#include "scenes.h"
+#include "Multidrop.h"
+
+// Old EEPROM layout
+// (HAS_ADDR: 1 = 8-bit address, 2 = 16-bit address with the high byte in ADDR_HI)
+#define OLD_EEPROM_HAS_ADDR      (uint8_t*)0
+#define OLD_EEPROM_ADDR          (uint8_t*)1
+#define OLD_EEPROM_DETECT_THRESH (uint8_t*)2
+#define OLD_EEPROM_DETECT_HYST   (uint8_t*)3
+#define OLD_EEPROM_WHITE_BALANCE (uint8_t*)4 // 3 bytes
+#define OLD_EEPROM_GAMMA         (uint8_t*)7
+#define OLD_EEPROM_POSITION      (uint8_t*)8 // x, y
+#define OLD_EEPROM_ADDR_HI       (uint8_t*)10
+
+static config_t config;
+
+uint16_t config_crc(config_t *cfg) {
+  uint8_t *b = (uint8_t*)cfg;
+  uint16_t crc = ~0;
+
+  for (uint8_t i = 0; i < offsetof(config_t, crc); i++) {
+    crc = _crc16_update(crc, b[i]);
+  }
+  return crc;
+}
+
+/**
+ * Fill in the settings from the old EEPROM layout.
+ * (An unprogrammed EEPROM reads 0xFF, which the application treats as the defaults)
+ */
+static void load_old_layout() {
+  uint8_t has_addr = eeprom_read_byte(OLD_EEPROM_HAS_ADDR);
+
+  config.address = 0;
+  if (has_addr == 1 || has_addr == 2) {
+    config.address = eeprom_read_byte(OLD_EEPROM_ADDR);
+    if (has_addr == 2) {
+      config.address |= eeprom_read_byte(OLD_EEPROM_ADDR_HI) << 8;
+    }
+  }
+
+  config.node_class = Multidrop::NO_CLASS;
+  config.class_index = 0;
+  config.detect_threshold = eeprom_read_byte(OLD_EEPROM_DETECT_THRESH);
+  config.detect_hysteresis = eeprom_read_byte(OLD_EEPROM_DETECT_HYST);
+  config.touch_profile = 0;
+  eeprom_read_block(config.white_balance, OLD_EEPROM_WHITE_BALANCE, 3);
+  config.gamma = eeprom_read_byte(OLD_EEPROM_GAMMA);
+  config.position[0] = eeprom_read_byte(OLD_EEPROM_POSITION);
+  config.position[1] = eeprom_read_byte(OLD_EEPROM_POSITION + 1);
+  config.boot_look = CONFIG_BOOT_DARK;
+  config.boot_color[0] = 0;
+  config.boot_color[1] = 0;
+  config.boot_color[2] = 0;
+  config.boot_scene = SCENE_NONE;
+}
+
+uint8_t config_load() {
+  eeprom_read_block(&config, CONFIG_EEPROM_ADDR, sizeof(config));
+
+  if (config.version == CONFIG_VERSION &&
+      config.size == sizeof(config) &&
+      config.crc == config_crc(&config)) {
+    return 1;
+  }
+
+  load_old_layout();
+  config_save();
+  return 0;
+}
+
+config_t* config_get() {
+  return &config;
+}
+
+void config_save() {
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(config);
+  config.crc = config_crc(&config);
+  eeprom_update_block(&config, CONFIG_EEPROM_ADDR, sizeof(config));
+}
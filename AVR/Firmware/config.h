@@ -0,0 +1,57 @@
+/**
+ * Node settings, kept together in one EEPROM block with a version and CRC.
+ * The block is read into RAM once at boot, so the node can take its address
+ * and show its last look before the master has said anything.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+// Where the block lives in the EEPROM (after the scenes).
+// The bootloader reads the address from here too.
+#define CONFIG_EEPROM_ADDR (void*)64
+
+// Bump this when the layout changes
+#define CONFIG_VERSION 1
+
+// What to show at boot (config_t.boot_look)
+#define CONFIG_BOOT_DARK  0 // LEDs off
+#define CONFIG_BOOT_COLOR 1 // config_t.boot_color
+#define CONFIG_BOOT_SCENE 2 // config_t.boot_scene
+
+typedef struct {
+  uint8_t  version;           // CONFIG_VERSION
+  uint8_t  size;              // sizeof(config_t)
+  uint16_t address;           // Bus address (0 if we haven't been addressed)
+  uint8_t  node_class;        // Class batch group (Multidrop::NO_CLASS if not set)
+  uint16_t class_index;       // Index within that class
+  uint8_t  detect_threshold;  // Touch settings, set by hand or by calibration
+  uint8_t  detect_hysteresis;
+  uint8_t  touch_profile;
+  uint8_t  white_balance[3];
+  uint8_t  gamma;
+  uint8_t  position[2];       // x, y on the floor grid
+  uint8_t  boot_look;         // CONFIG_BOOT_*
+  uint8_t  boot_color[3];
+  uint8_t  boot_scene;
+  uint16_t crc;               // CRC16 of everything before it
+} config_t;
+
+// Load the settings from the EEPROM.
+// If the block is missing or invalid, the settings are taken from the older
+// layout (one EEPROM byte per setting) and saved as a new block.
+// Returns 1 if the block was valid.
+uint8_t config_load();
+
+// Get the settings (change them, then call config_save())
+config_t* config_get();
+
+// Save the settings (only the bytes that changed are written)
+void config_save();
+
+// CRC of a settings block, for checking it
+uint16_t config_crc(config_t *cfg);
+
+#endif
@@ -0,0 +1,152 @@
+/*******************************************************************************
+* Effects
+*
+* Node-side wave effects, using fixed-point math and a sine lookup table.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "effects.h"
+#include "geometry.h"
+
+// One full sine wave over 256 steps, scaled to 0 - 255
+static const uint8_t sine_table[256] PROGMEM = {
+  128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+  176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+  218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+  245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+  255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+  245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+  218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+  176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+  128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+   79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+   37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+   10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+    0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+   10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+   37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+   79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124
+};
+
+static uint8_t type = EFFECT_NONE;
+static uint8_t colors[2][3];
+static int16_t speed;
+
+// The parts of the wave phase that only depend on our position
+static uint8_t phase_a;
+static uint8_t phase_b;
+
+// Time since the effect started (ms)
+static uint32_t elapsed;
+static uint16_t last_time;
+
+static uint8_t sine(uint8_t angle) {
+  return pgm_read_byte(&sine_table[angle]);
+}
+
+// Sine, centered on zero (-128 to 127)
+static int8_t sine_signed(uint8_t angle) {
+  return (int8_t)(sine(angle) - 128);
+}
+
+static int16_t param16(uint8_t *data) {
+  return (int16_t)((data[0] << 8) | data[1]);
+}
+
+// Convert a distance (1/16th cells) into a phase angle
+static uint8_t distance_to_phase(int32_t dist, uint16_t wavelength) {
+  return (uint8_t)((dist * 256) / wavelength);
+}
+
+void effect_start(uint8_t *data, uint16_t now) {
+  int32_t dx, dy, dist;
+  uint16_t wavelength;
+  uint8_t i, dir;
+
+  type = data[0];
+  if (type == EFFECT_NONE || !geometry_has_position()) {
+    type = EFFECT_NONE;
+    return;
+  }
+
+  dx = (int32_t)geometry_x() - geometry_clamp(param16(&data[1]), GEOMETRY_COORD_LIMIT);
+  dy = (int32_t)geometry_y() - geometry_clamp(param16(&data[3]), GEOMETRY_COORD_LIMIT);
+  dir = data[5];
+  wavelength = (uint16_t)param16(&data[6]);
+  speed = param16(&data[8]);
+  if (wavelength == 0) {
+    wavelength = 1;
+  }
+
+  for (i = 0; i < 3; i++) {
+    colors[0][i] = data[10 + i];
+    colors[1][i] = data[13 + i];
+  }
+
+  switch (type) {
+    // Distance along the direction
+    case EFFECT_GRADIENT:
+      dist = ((dx * sine_signed(dir + 64)) + (dy * sine_signed(dir))) / 128;
+      phase_a = distance_to_phase(dist, wavelength);
+    break;
+
+    // Distance from the origin
+    case EFFECT_RADIAL:
+      dist = isqrt((dx * dx) + (dy * dy));
+      phase_a = distance_to_phase(dist, wavelength);
+    break;
+
+    // Separate waves along each axis
+    case EFFECT_PLASMA:
+      phase_a = distance_to_phase(dx, wavelength);
+      phase_b = distance_to_phase(dy, wavelength);
+    break;
+  }
+
+  elapsed = 0;
+  last_time = now;
+}
+
+void effect_stop() {
+  type = EFFECT_NONE;
+}
+
+uint8_t effect_running() {
+  return type != EFFECT_NONE;
+}
+
+uint8_t effect_step(uint16_t now, uint8_t *rgb) {
+  uint8_t i, shift, level;
+  uint32_t secs;
+  uint16_t ms;
+  int16_t diff;
+
+  if (type == EFFECT_NONE) return 0;
+
+  elapsed += (uint16_t)(now - last_time);
+  last_time = now;
+
+  // How far the wave has moved.
+  // (only the lower 8 bits matter, so the whole seconds can use 8-bit math)
+  secs = elapsed / 1000;
+  ms = elapsed % 1000;
+  shift = ((uint8_t)speed * (uint8_t)secs) + (uint8_t)(((int32_t)speed * ms) / 1000);
+
+  if (type == EFFECT_PLASMA) {
+    level = ((uint16_t)sine(phase_a + shift) +
+             sine(phase_b - shift) +
+             sine(phase_a + phase_b + (shift >> 1)) +
+             sine(phase_a - phase_b - (shift >> 1))) >> 2;
+  } else {
+    level = sine(phase_a - shift);
+  }
+
+  // Blend between the two colors
+  for (i = 0; i < 3; i++) {
+    diff = (int16_t)colors[1][i] - colors[0][i];
+    rgb[i] = colors[0][i] + (int16_t)(((int32_t)diff * level) / 255);
+  }
+  return 1;
+}
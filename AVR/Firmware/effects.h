@@ -0,0 +1,45 @@
+/**
+ * Continuous effects that each node computes for itself from its grid
+ * position and the time since the effect started. After the master
+ * broadcasts the effect settings, the whole floor animates without any
+ * more bus traffic.
+ *
+ * The effect is a wave that blends between two colors:
+ *  + EFFECT_GRADIENT: Straight bands moving along a direction.
+ *  + EFFECT_RADIAL:   Rings moving out from (or into) the origin.
+ *  + EFFECT_PLASMA:   A few overlapping waves that look like moving plasma.
+ */
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <stdint.h>
+
+#define EFFECT_NONE     0x00
+#define EFFECT_GRADIENT 0x01
+#define EFFECT_RADIAL   0x02
+#define EFFECT_PLASMA   0x03
+
+// Length of the effect message
+#define EFFECT_MSG_LEN 16
+
+// Start an effect from the message data:
+//   [0]      Effect type (EFFECT_*)
+//   [1..4]   Origin x, y (int16, 1/16th cells, clamped to GEOMETRY_COORD_LIMIT)
+//   [5]      Direction of a gradient (256 = full turn)
+//   [6..7]   Wavelength (uint16, 1/16th cells)
+//   [8..9]   Speed (int16, 1/256th wavelengths per second)
+//   [10..12] First color
+//   [13..15] Second color
+void effect_start(uint8_t *data, uint16_t now);
+
+// Stop the current effect
+void effect_stop();
+
+// Is an effect running
+uint8_t effect_running();
+
+// Put the color for `now` into `rgb`. Returns 1 if an effect is running.
+uint8_t effect_step(uint16_t now, uint8_t *rgb);
+
+#endif
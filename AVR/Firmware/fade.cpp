@@ -0,0 +1,54 @@
+/*******************************************************************************
+* Fade
+*
+* Linear fade between two RGB colors.
+******************************************************************************/
+
+#include "fade.h"
+
+static uint8_t fade_from[3];
+static uint8_t fade_to[3];
+static uint16_t fade_start_time;
+static uint16_t fade_duration;
+static uint8_t fading = 0;
+
+void fade_start(uint8_t *from, uint8_t *to, uint16_t duration, uint16_t now) {
+  uint8_t i;
+  for (i = 0; i < 3; i++) {
+    fade_from[i] = from[i];
+    fade_to[i] = to[i];
+  }
+  fade_start_time = now;
+  fade_duration = duration;
+  fading = 1;
+}
+
+void fade_stop() {
+  fading = 0;
+}
+
+uint8_t fade_running() {
+  return fading;
+}
+
+uint8_t fade_step(uint16_t now, uint8_t *rgb) {
+  uint8_t i;
+  uint16_t elapsed = now - fade_start_time;
+
+  if (!fading) return 0;
+
+  // Done
+  if (elapsed >= fade_duration) {
+    for (i = 0; i < 3; i++) {
+      rgb[i] = fade_to[i];
+    }
+    fading = 0;
+    return 0;
+  }
+
+  for (i = 0; i < 3; i++) {
+    int16_t diff = (int16_t)fade_to[i] - fade_from[i];
+    rgb[i] = fade_from[i] + (int16_t)(((int32_t)diff * elapsed) / fade_duration);
+  }
+  return 1;
+}
@@ -0,0 +1,23 @@
+/**
+ * Fades the RGB LED from one color to another over time.
+ */
+
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdint.h>
+
+// Start fading between two RGB colors over `duration` milliseconds
+void fade_start(uint8_t *from, uint8_t *to, uint16_t duration, uint16_t now);
+
+// Stop the current fade where it is
+void fade_stop();
+
+// Is a fade in progress
+uint8_t fade_running();
+
+// Put the color for `now` into `rgb`.
+// Returns 1 if a fade is running, and 0 when it's done (and `rgb` is the final color).
+uint8_t fade_step(uint16_t now, uint8_t *rgb);
+
+#endif
@@ -0,0 +1,155 @@
+/*******************************************************************************
+* Geometry
+*
+* Node position and shape hit-testing.
+******************************************************************************/
+
+#include "geometry.h"
+
+static uint8_t pos_x = POSITION_UNSET;
+static uint8_t pos_y = POSITION_UNSET;
+
+// Read the nth big endian int16 from a parameter list
+static int16_t param(uint8_t *params, uint8_t n) {
+  return (int16_t)((params[n * 2] << 8) | params[(n * 2) + 1]);
+}
+
+// Read the nth parameter, clamped to +/- limit
+static int32_t clamped_param(uint8_t *params, uint8_t n, int16_t limit) {
+  return geometry_clamp(param(params, n), limit);
+}
+
+int16_t geometry_clamp(int16_t value, int16_t limit) {
+  if (value > limit) return limit;
+  if (value < -limit) return -limit;
+  return value;
+}
+
+void geometry_set_position(uint8_t x, uint8_t y) {
+  pos_x = x;
+  pos_y = y;
+}
+
+uint8_t geometry_has_position() {
+  return !(pos_x == POSITION_UNSET && pos_y == POSITION_UNSET);
+}
+
+int16_t geometry_x() {
+  return (int16_t)pos_x << GEOMETRY_FRAC_BITS;
+}
+
+int16_t geometry_y() {
+  return (int16_t)pos_y << GEOMETRY_FRAC_BITS;
+}
+
+uint8_t geometry_contains(uint8_t shape, uint8_t *params, uint8_t len) {
+  int16_t px = geometry_x(),
+          py = geometry_y();
+  int32_t dx, dy, dist2;
+
+  if (!geometry_has_position()) return 0;
+
+  switch (shape) {
+    case SHAPE_RECT:
+      if (len < 8) return 0;
+      return px >= param(params, 0) && py >= param(params, 1) &&
+             px <= param(params, 2) && py <= param(params, 3);
+
+    case SHAPE_CIRCLE:
+    case SHAPE_RING: {
+      int32_t radius;
+
+      if (len < 6) return 0;
+      dx = (int32_t)px - clamped_param(params, 0, GEOMETRY_COORD_LIMIT);
+      dy = (int32_t)py - clamped_param(params, 1, GEOMETRY_COORD_LIMIT);
+      dist2 = (dx * dx) + (dy * dy);
+      radius = clamped_param(params, 2, GEOMETRY_SIZE_LIMIT);
+
+      if (shape == SHAPE_CIRCLE) {
+        return dist2 <= radius * radius;
+      }
+
+      // Ring: within half the width of the radius
+      if (len < 8) return 0;
+      int32_t half = clamped_param(params, 3, GEOMETRY_SIZE_LIMIT) / 2,
+              inner = radius - half,
+              outer = radius + half;
+      if (inner < 0) inner = 0;
+      return dist2 >= inner * inner && dist2 <= outer * outer;
+    }
+
+    case SHAPE_LINE: {
+      int32_t x0, y0, lx, ly, len2, dot, cross, half;
+
+      if (len < 10) return 0;
+      x0 = clamped_param(params, 0, GEOMETRY_COORD_LIMIT);
+      y0 = clamped_param(params, 1, GEOMETRY_COORD_LIMIT);
+      lx = clamped_param(params, 2, GEOMETRY_COORD_LIMIT) - x0;
+      ly = clamped_param(params, 3, GEOMETRY_COORD_LIMIT) - y0;
+      half = clamped_param(params, 4, GEOMETRY_SIZE_LIMIT) / 2;
+      dx = (int32_t)px - x0;
+      dy = (int32_t)py - y0;
+
+      len2 = (lx * lx) + (ly * ly);
+      dot = (dx * lx) + (dy * ly);
+
+      // Closest to the first end
+      if (dot <= 0 || len2 == 0) {
+        return (dx * dx) + (dy * dy) <= half * half;
+      }
+      // Closest to the second end
+      if (dot >= len2) {
+        dx -= lx;
+        dy -= ly;
+        return (dx * dx) + (dy * dy) <= half * half;
+      }
+      // Distance from the line is |cross| / length
+      cross = (dx * ly) - (dy * lx);
+      if (cross < 0) cross = -cross;
+      return cross <= half * isqrt(len2);
+    }
+  }
+  return 0;
+}
+
+void geometry_blend(uint8_t mode, uint8_t *current, uint8_t *color, uint8_t *out) {
+  uint8_t i;
+  int16_t c;
+
+  for (i = 0; i < 3; i++) {
+    switch (mode & BLEND_MODE_MASK) {
+      case BLEND_ADD:
+        c = current[i] + color[i];
+        out[i] = (c > 0xFF) ? 0xFF : c;
+      break;
+      case BLEND_SUBTRACT:
+        c = current[i] - color[i];
+        out[i] = (c < 0) ? 0 : c;
+      break;
+      case BLEND_MAX:
+        out[i] = (color[i] > current[i]) ? color[i] : current[i];
+      break;
+      default:
+        out[i] = color[i];
+    }
+  }
+}
+
+uint16_t isqrt(uint32_t value) {
+  uint32_t root = 0,
+           bit = 1UL << 30;
+
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
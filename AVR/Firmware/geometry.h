@@ -0,0 +1,65 @@
+/**
+ * Shapes drawn across the floor by a single broadcast message.
+ *
+ * Every node knows its own grid position, so it can test whether it's inside
+ * a shape and change its own color, without the master sending a full frame.
+ *
+ * Positions and sizes are in 1/16th of a cell (12.4 fixed point) and the
+ * center of a cell is at (x * 16, y * 16).
+ */
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stdint.h>
+
+// Fraction bits in a grid coordinate
+#define GEOMETRY_FRAC_BITS 4
+
+// Coordinates from the master are clamped to a couple of grid widths around
+// the grid (and sizes to twice that), so their squares fit in an int32
+#define GEOMETRY_COORD_LIMIT ((255 << GEOMETRY_FRAC_BITS) * 2)
+#define GEOMETRY_SIZE_LIMIT  (GEOMETRY_COORD_LIMIT * 2)
+
+// Position of a node that has not been told where it is
+#define POSITION_UNSET 0xFF
+
+// Shapes (and the int16 parameters that follow, big endian)
+#define SHAPE_RECT   0x00 // x0, y0, x1, y1 (inclusive corners)
+#define SHAPE_CIRCLE 0x01 // x, y, radius (filled)
+#define SHAPE_RING   0x02 // x, y, radius, width
+#define SHAPE_LINE   0x03 // x0, y0, x1, y1, width
+
+// How a shape's color is combined with the current color
+#define BLEND_REPLACE  0x00
+#define BLEND_ADD      0x01
+#define BLEND_SUBTRACT 0x02
+#define BLEND_MAX      0x03
+#define BLEND_MODE_MASK 0x0F
+
+// Blend flag: nodes outside of the shape turn off
+#define BLEND_CLEAR_OUTSIDE 0x80
+
+// Set this node's grid position
+void geometry_set_position(uint8_t x, uint8_t y);
+
+// Has the node been given a position
+uint8_t geometry_has_position();
+
+// This node's position, in grid coordinates
+int16_t geometry_x();
+int16_t geometry_y();
+
+// Is this node inside the shape described by the message params (big endian int16 values)
+uint8_t geometry_contains(uint8_t shape, uint8_t *params, uint8_t len);
+
+// Combine `color` with `current` using one of the BLEND_* modes
+void geometry_blend(uint8_t mode, uint8_t *current, uint8_t *color, uint8_t *out);
+
+// Clamp a coordinate or size to +/- limit
+int16_t geometry_clamp(int16_t value, int16_t limit);
+
+// Integer square root
+uint16_t isqrt(uint32_t value);
+
+#endif
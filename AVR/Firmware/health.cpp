@@ -0,0 +1,78 @@
+/*******************************************************************************
+* Health
+*
+* The watchdog reset count lives in .noinit RAM, so it survives the reset
+* and is only cleared on power up. The loop timing measures from the start
+* of one main loop iteration to the start of the next.
+******************************************************************************/
+
+#include <avr/io.h>
+#include "health.h"
+
+#define HEALTH_MAGIC 0xD15C
+
+static uint16_t noinit_magic __attribute__((section(".noinit")));
+static uint8_t wdt_resets __attribute__((section(".noinit")));
+
+static uint8_t loop_started = 0;
+static uint16_t last_loop_ms;
+static uint16_t last_loop_us;
+static uint16_t max_loop_us = 0;
+
+// Kept apart from the touch stats, which CMD_GET_TOUCH_STATS starts over
+static uint16_t touch_bursts = 0;
+
+void health_init(uint8_t reset_flags) {
+  if ((reset_flags & (1 << PORF)) || noinit_magic != HEALTH_MAGIC) {
+    noinit_magic = HEALTH_MAGIC;
+    wdt_resets = 0;
+  }
+  if ((reset_flags & (1 << WDRF)) && wdt_resets < 0xFF) {
+    wdt_resets++;
+  }
+}
+
+void health_loop(uint16_t now_ms, uint16_t now_us) {
+  if (loop_started) {
+    uint16_t elapsed;
+
+    // micros() wraps every ~65ms, so use millis() for long iterations
+    if ((uint16_t)(now_ms - last_loop_ms) >= 65) {
+      elapsed = 0xFFFF;
+    } else {
+      elapsed = now_us - last_loop_us;
+    }
+
+    if (elapsed > max_loop_us) {
+      max_loop_us = elapsed;
+    }
+  }
+
+  loop_started = 1;
+  last_loop_ms = now_ms;
+  last_loop_us = now_us;
+}
+
+uint8_t health_wdt_resets() {
+  return wdt_resets;
+}
+
+uint16_t health_max_loop_us() {
+  return max_loop_us;
+}
+
+void health_touch_burst() {
+  if (touch_bursts < 0xFFFF) {
+    touch_bursts++;
+  }
+}
+
+uint16_t health_touch_bursts() {
+  return touch_bursts;
+}
+
+void health_reset() {
+  max_loop_us = 0;
+  loop_started = 0;
+  touch_bursts = 0;
+}
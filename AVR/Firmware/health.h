@@ -0,0 +1,32 @@
+/**
+ * Keeps node health stats that aren't tracked by the bus library:
+ * watchdog resets, the main loop timing and the touch sensor bursts.
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <stdint.h>
+
+// Start tracking health, with the reset flags (MCUSR) from startup
+void health_init(uint8_t reset_flags);
+
+// Call at the start of every main loop iteration
+void health_loop(uint16_t now_ms, uint16_t now_us);
+
+// Number of watchdog resets since the node was powered on
+uint8_t health_wdt_resets();
+
+// The longest main loop iteration, in microseconds (0xFFFF if it was 65ms or more)
+uint16_t health_max_loop_us();
+
+// Call for every touch sensor burst
+void health_touch_burst();
+
+// Touch sensor bursts (stops at 0xFFFF)
+uint16_t health_touch_bursts();
+
+// Reset the loop timing and burst count (watchdog resets are only cleared by a power cycle)
+void health_reset();
+
+#endif
@@ -5,6 +5,51 @@
 Multidrop::Multidrop(MultidropData *_serial) : serial(_serial) {
 }
 
+#ifdef MD_STATIC_DAISY
+
+typedef MD_DAISY1_PIN Daisy1;
+typedef MD_DAISY2_PIN Daisy2;
+
+void Multidrop::addDaisyChain(uint8_t set_polarity) {
+
+  // Init polarity checks
+  daisy_prev = 0;
+  daisy_next = 0;
+
+  // Init registers & internal pull-ups
+  Daisy1::input();
+  Daisy1::high();
+
+  Daisy2::input();
+  Daisy2::high();
+
+  if (set_polarity) {
+    setDaisyChainPolarity(1, 2);
+  }
+}
+
+uint8_t Multidrop::readDaisyLine(uint8_t line) {
+  return (line == 2) ? Daisy2::read() : Daisy1::read();
+}
+
+void Multidrop::setDaisyLineOutput(uint8_t line) {
+  if (line == 2) {
+    Daisy2::output();
+  } else {
+    Daisy1::output();
+  }
+}
+
+void Multidrop::setDaisyLineLevel(uint8_t line, uint8_t high) {
+  if (line == 2) {
+    if (high) Daisy2::high(); else Daisy2::low();
+  } else {
+    if (high) Daisy1::high(); else Daisy1::low();
+  }
+}
+
+#else
+
 void Multidrop::addDaisyChain(volatile uint8_t d1_pin_number,
                               volatile uint8_t* d1_ddr_register,
                               volatile uint8_t* d1_port_register,
@@ -43,11 +88,39 @@ void Multidrop::addDaisyChain(volatile uint8_t d1_pin_number,
   }
 }
 
+uint8_t Multidrop::readDaisyLine(uint8_t line) {
+  if (line == 2) {
+    return (*d2_pin & (1 << d2_num)) != 0;
+  }
+  return (*d1_pin & (1 << d1_num)) != 0;
+}
+
+void Multidrop::setDaisyLineOutput(uint8_t line) {
+  if (line == 2) {
+    *d2_ddr |= (1 << d2_num);
+  } else {
+    *d1_ddr |= (1 << d1_num);
+  }
+}
+
+void Multidrop::setDaisyLineLevel(uint8_t line, uint8_t high) {
+  uint8_t mask = (line == 2) ? (1 << d2_num) : (1 << d1_num);
+  volatile uint8_t* port = (line == 2) ? d2_port : d1_port;
+
+  if (high) {
+    *port |= mask;
+  } else {
+    *port &= ~mask;
+  }
+}
+
+#endif
+
 void Multidrop::checkDaisyChainPolarity() {
   if (daisy_prev && daisy_next) return;
 
-  uint8_t d1 = !(*d1_pin & (1 << d1_num)),
-          d2 = !(*d2_pin & (1 << d2_num));
+  uint8_t d1 = !readDaisyLine(1),
+          d2 = !readDaisyLine(2);
 
   // No clear polarity
   if (d1 == d2) {
@@ -77,38 +150,43 @@ void Multidrop::setDaisyChainPolarity(uint8_t prev, uint8_t next) {
   daisy_next = next;
 
   // Change pin to output
-  if (daisy_next == 1) {
-    *d1_ddr |= (1 << d1_num);
-  } else {
-    *d2_ddr |= (1 << d2_num);
-  }
+  setDaisyLineOutput(daisy_next);
 }
 
 uint8_t Multidrop::setNextDaisyValue(uint8_t val) {
   if (!daisy_next) return 0;
 
-  uint8_t mask = (daisy_next == 2) ? (1 << d2_num) : (1 << d1_num);
-  volatile uint8_t* ddr = (daisy_next == 2) ? d2_ddr : d1_ddr;
-  volatile uint8_t* port = (daisy_next == 2) ? d2_port : d1_port;
-
   // Set as output
-  *ddr |= mask;
+  setDaisyLineOutput(daisy_next);
 
   // Active low
-  if (val) {
-    *port &= ~mask;
-  } else {
-    *port |= mask;
-  }
+  setDaisyLineLevel(daisy_next, !val);
   return 1;
 }
 
 uint8_t Multidrop::isPrevDaisyEnabled() {
   if (!daisy_prev) return 0;
+  return !readDaisyLine(daisy_prev);
+}
 
-  uint8_t mask = (daisy_prev == 2) ? (1 << d2_num) : (1 << d1_num);
-  volatile uint8_t* pin = (daisy_prev == 2) ? d2_pin : d1_pin;
 
-  return !(*pin & mask);
+uint32_t Multidrop::baudRate(uint8_t index) {
+  switch (index) {
+    case MD_BAUD_250K:  return 250000;
+    case MD_BAUD_312K:  return 312500;
+    case MD_BAUD_500K:  return 500000;
+    case MD_BAUD_625K:  return 625000;
+    case MD_BAUD_1M:    return 1000000;
+    case MD_BAUD_1250K: return 1250000;
+  }
+  return 0;
 }
 
+uint8_t Multidrop::berNext(uint16_t *state) {
+  uint16_t x = *state;
+  x ^= x << 7;
+  x ^= x >> 9;
+  x ^= x << 8;
+  *state = x;
+  return x & 0xFF;
+}
@@ -9,11 +9,89 @@
 #include <avr/io.h>
 #include <stdint.h>
 #include "MultidropData.h"
+#include "MultidropPins.h"
+
+// The daisy chain lines can be fixed at compile time by defining both of these
+// as pin descriptors (see MultidropPins.h), for example:
+//   -D'MD_DAISY1_PIN=MdPin<MD_PORTC_IO,PC3>' -D'MD_DAISY2_PIN=MdPin<MD_PORTC_IO,PC4>'
+// The lines are then set up with addDaisyChain(set_polarity), and use single
+// instructions instead of register pointers kept in RAM.
+#if defined(MD_DAISY1_PIN) && defined(MD_DAISY2_PIN)
+#define MD_STATIC_DAISY
+#endif
+
+// Version of the bus protocol this library implements
+#define MD_PROTOCOL_VERSION      3
+#define MD_EXT_PROTOCOL_VERSION  2 // First version that supports extended headers
+#define MD_CAPS_PROTOCOL_VERSION 3 // First version that answers CMD_GET_CAPS itself
 
 #define CMD_RESET   0xFA
 #define CMD_ADDRESS 0xFB
 #define CMD_NULL    0xFF
 
+// Bulk transfer commands
+#define CMD_BULK_START  0xF0 // data: size (2 bytes), chunk size, stream ID
+#define CMD_BULK_DATA   0xF1 // data: sequence number (2 bytes), chunk
+#define CMD_BULK_STATUS 0xF2 // response: next sequence number wanted (2 bytes), bulk state
+
+// Node setup commands
+#define CMD_SET_CLASS    0xF3 // data: node class, index within that class (1 or 2 bytes)
+#define CMD_GET_PROTOCOL 0xF4 // response: MD_PROTOCOL_VERSION
+#define CMD_GET_CAPS     0xF5 // response: capabilities (MD_CAPS_LEN bytes, see md_caps_t)
+#define CMD_SET_BAUD     0xF6 // data: baud rate index (MD_BAUD_*)
+
+// Bit error rate test commands
+#define CMD_BER_START  0xF7 // data: pattern seed (2 bytes), baud rate index to test at, test length
+                            // (bytes on the wire, 3 bytes). Resets the error counts
+#define CMD_BER_DATA   0xF8 // data: test pattern
+#define CMD_BER_STATUS 0xF9 // response: error counts (MD_BER_STATUS_LEN bytes)
+
+// CMD_BER_STATUS response: frames (2 bytes), bytes checked (4 bytes),
+// byte errors (2 bytes), bit errors (2 bytes). Error counts stop at 0xFFFF.
+#define MD_BER_STATUS_LEN 10
+
+// Decoded CMD_BER_STATUS response
+typedef struct {
+  uint16_t frames;      // Test frames the node saw
+  uint32_t bytes;       // Pattern bytes checked
+  uint16_t byteErrors,
+           bitErrors;
+} md_ber_t;
+
+// Protocol features (md_caps_t.features)
+#define MD_FEATURE_BULK     0x01
+#define MD_FEATURE_RANGE    0x02
+#define MD_FEATURE_CLASS    0x04
+#define MD_FEATURE_EXTENDED 0x08
+
+// Bus baud rates, as bit indexes in md_caps_t.bauds
+#define MD_BAUD_250K  0
+#define MD_BAUD_312K  1
+#define MD_BAUD_500K  2
+#define MD_BAUD_625K  3
+#define MD_BAUD_1M    4
+#define MD_BAUD_1250K 5
+#define MD_BAUD_COUNT 6
+#define MD_BAUD_NONE  0xFF
+
+// Capabilities reported by each node with CMD_GET_CAPS
+#define MD_CAPS_LEN 7
+typedef struct {
+  uint8_t version,      // MD_PROTOCOL_VERSION
+          features,     // Protocol features (MD_FEATURE_*)
+          bauds,        // Supported baud rates (1 << MD_BAUD_*)
+          appFeatures,  // Application specific features
+          maxDataLen,   // Largest message data the node will read
+          bulkChunkLen, // Largest bulk transfer chunk
+          rxBufferLen;  // Size of the receive buffer
+} md_caps_t;
+
+// Bulk transfer states (reported by CMD_BULK_STATUS)
+#define BULK_IDLE      0x00
+#define BULK_RECEIVING 0x01
+#define BULK_DONE      0x02
+#define BULK_ERROR     0x03
+
 class Multidrop {
 
 public:
@@ -21,6 +99,24 @@ public:
   static const uint8_t BATCH_FLAG = 0b00000001;
   static const uint8_t RESPONSE_MESSAGE_FLAG = 0b00000010;
 
+  // Batch message that only covers a range of nodes. The header address
+  // is the first node in the range and the node count is how many follow.
+  static const uint8_t RANGE_FLAG = 0b00000100;
+
+  // Batch message with a different slot size for each node class. The node
+  // count is replaced by the number of classes, followed by a table with the
+  // node count and slot length of each class. Each class's slots follow the
+  // previous class's, in class index order.
+  static const uint8_t CLASS_FLAG = 0b00001000;
+
+  // Extended header: 16-bit addresses and node counts (high byte first).
+  // Only nodes running MD_PROTOCOL_VERSION >= MD_EXT_PROTOCOL_VERSION can parse
+  // these, so they can only be used once every node on the bus supports them.
+  static const uint8_t EXT_FLAG = 0b00010000;
+
+  // Node class is not set
+  static const uint8_t NO_CLASS = 0xFF;
+
   Multidrop(MultidropData*);
 
   // Add the pin and registers for the daisy chain lines.
@@ -28,6 +124,9 @@ public:
   // Otherwise, polarity will be determined at runtime by setting the first to
   // be enabled as the previous daisy line.
   // (you can also set polarity with the setDaisyChainPolarity() method)
+#ifdef MD_STATIC_DAISY
+  void addDaisyChain(uint8_t set_polarity=false);
+#else
   void addDaisyChain(volatile uint8_t d1_pin_num,
                      volatile uint8_t* d1_ddr_register,
                      volatile uint8_t* d1_port_register,
@@ -39,6 +138,7 @@ public:
                      volatile uint8_t* d2_pin_register,
 
                      uint8_t set_polarity=false);
+#endif
 
   // Get the daisy chain number (1 or 2) for the previous node
   // this will return 0 if the polarity has not been determined yet
@@ -48,6 +148,12 @@ public:
   // this will return 0 if the polarity has not been determined yet
   uint8_t getDaisyChainNext();
 
+  // Get the baud rate for a MD_BAUD_* index (0 if invalid)
+  static uint32_t baudRate(uint8_t index);
+
+  // Next byte of the bit error rate test pattern (xorshift, `state` must not be 0)
+  static uint8_t berNext(uint16_t *state);
+
   // Set the daisy chain polarity
   // next and prev should be set to 1 or 2, which matches
   // the pins for d1_* and d2_* defined in addDaisyChain()
@@ -65,6 +171,7 @@ protected:
 
   uint16_t messageCRC;
 
+#ifndef MD_STATIC_DAISY
   // Daisy chain pin registers
   volatile uint8_t d1_num,
                    d2_num;
@@ -74,6 +181,7 @@ protected:
   volatile uint8_t* d2_ddr;
   volatile uint8_t* d2_port;
   volatile uint8_t* d2_pin;
+#endif
 
   uint8_t daisy_prev,
           daisy_next;
@@ -87,6 +195,11 @@ protected:
   // Get the value (1 or 0) from the prev daisy chain pin
   uint8_t isPrevDaisyEnabled();
 
+  // Access to daisy chain line 1 or 2
+  uint8_t readDaisyLine(uint8_t line);
+  void setDaisyLineOutput(uint8_t line);
+  void setDaisyLineLevel(uint8_t line, uint8_t high);
+
 };
 
 #endif
@@ -0,0 +1,72 @@
+/**
+ * Bus bootloader protocol.
+ *
+ * The bootloader (see AVR/Bootloader) uses the normal multidrop framing, so the
+ * master can flash every node at once: pages are broadcast to all nodes, then
+ * a batch response message collects which pages each node is still missing
+ * and only those are sent again.
+ *
+ *   1. CMD_BOOT_ENTER to restart the nodes into the bootloader. The bootloader
+ *      only runs at MD_BAUD_250K.
+ *   2. CMD_BOOT_START with the image size and CRC.
+ *   3. CMD_BOOT_PAGE for every page, at most one every BOOT_PAGE_MS.
+ *   4. Batch response message with CMD_BOOT_STATUS (BOOT_STATUS_LEN bytes per node).
+ *   5. Repeat 3 and 4 for the missing pages, until every node is BOOT_DONE.
+ *   6. CMD_BOOT_FINISH to check the whole image and start the new firmware.
+ *
+ * Most releases only change a few pages, so step 2 can be CMD_BOOT_PATCH
+ * instead. This names the base image the update was made against, by its CRC,
+ * and which pages differ from it. Nodes running that base keep their other
+ * pages and only ask for the changed ones. Any other node asks for every page
+ * of the new image, so the missing page bitmaps in step 4 make the master
+ * fall back to sending the full image to them. (Nodes only write the pages
+ * they're missing, so this doesn't rewrite the patched nodes.)
+ */
+
+#ifndef MultidropBoot_H
+#define MultidropBoot_H
+
+#include <stdint.h>
+
+#define CMD_BOOT_PATCH  0xEA // data: patch header (BOOT_PATCH_HEADER_LEN bytes)
+#define CMD_BOOT_ENTER  0xEB // Restart into the bootloader (handled by the application)
+#define CMD_BOOT_START  0xEC // data: number of pages, image CRC (2 bytes)
+#define CMD_BOOT_PAGE   0xED // data: page number, page CRC (2 bytes), page data (BOOT_PAGE_SIZE bytes)
+#define CMD_BOOT_STATUS 0xEE // response: boot state, missing page bitmap
+#define CMD_BOOT_FINISH 0xEF // Check the image CRC and start the application
+
+// Flash page size of the ATmega328P
+#define BOOT_PAGE_SIZE 128
+
+// Application pages below the 4KB bootloader section
+#define BOOT_MAX_PAGES 224
+
+// Minimum time between pages, to give nodes time to erase and write the last one
+#define BOOT_PAGE_MS 10
+
+// Patch header: number of pages, image CRC (2 bytes), base image pages,
+// base image CRC (2 bytes), then 1 bit per page (page 0 is bit 0 of the first
+// byte), set if the page differs from the base image.
+// A patch is this header, followed by the changed pages in page order.
+#define BOOT_PATCH_HEADER_LEN (6 + BOOT_MAX_PAGES / 8)
+
+// Time nodes need, after CMD_BOOT_PATCH, to check the base image
+#define BOOT_PATCH_MS 50
+
+// CMD_BOOT_STATUS response length for an image of `pages` pages:
+// boot state, then 1 bit per page (page 0 is bit 0 of the first byte), set if the page is missing
+#define BOOT_STATUS_LEN(pages) (1 + ((pages) + 7) / 8)
+
+// Boot states (first byte of CMD_BOOT_STATUS).
+// Nodes still running the application respond with zeros (BOOT_IDLE).
+#define BOOT_IDLE      0x00
+#define BOOT_RECEIVING 0x01 // Receiving pages
+#define BOOT_DONE      0x02 // Every page received and verified
+#define BOOT_ERROR     0x03 // The image CRC did not match on CMD_BOOT_FINISH
+
+// EEPROM byte the application sets to BOOT_FLAG_UPDATE, before restarting,
+// to stay in the bootloader
+#define BOOT_EEPROM_FLAG (uint8_t*)1023
+#define BOOT_FLAG_UPDATE 0xB0
+
+#endif
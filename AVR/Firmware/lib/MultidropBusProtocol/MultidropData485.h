@@ -3,6 +3,7 @@
 #define MultidropData485_H
 
 #include "MultidropDataUart.h"
+#include "MultidropPins.h"
 #include <avr/io.h>
 
 class MultidropData485 : public MultidropDataUart {
@@ -21,4 +22,28 @@ private:
   volatile uint8_t* de_port;
 };
 
+// The same, with the DE pin fixed at compile time (see MultidropPins.h):
+//   MultidropData485Pin<MdPin<MD_PORTD_IO, PD2> > serial;
+template <class DePin>
+class MultidropData485Pin : public MultidropDataUart {
+public:
+  MultidropData485Pin() {
+    DePin::output();
+    DePin::low();
+  }
+
+  void write(uint8_t b) {
+    MultidropDataUart::write(b);
+  }
+
+  void enable_write() {
+    DePin::high();
+  }
+
+  void enable_read() {
+    flush();
+    DePin::low();
+  }
+};
+
 #endif
\ No newline at end of file
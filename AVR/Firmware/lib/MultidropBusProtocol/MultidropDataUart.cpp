@@ -1,6 +1,8 @@
 
 #include "MultidropDataUart.h"
+#include "MultidropTrace.h"
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 ////////////////////////////////////////////
 /// Prototypes
@@ -20,14 +22,8 @@ void writeByteToRegister(uint8_t);
 #define UART0_UDR   UDR0
 #define UART0_UDRE  UDRE0
 #define UART0_TXC   TXC0
-
-#ifndef UART0_RX_BUFFER_SIZE
-#define UART0_RX_BUFFER_SIZE 150
-#endif
-
-#ifndef UART0_TX_BUFFER_SIZE
-#define UART0_TX_BUFFER_SIZE 60
-#endif
+#define UART0_FE    FE0
+#define UART0_DOR   DOR0
 
 
 #define UART_BAUD_SELECT(baudRate)  (((F_CPU) + 8UL * (baudRate)) / (16UL * (baudRate)) -1UL)
@@ -53,6 +49,11 @@ static volatile uint8_t tx_buffer_tail;
 static volatile uint8_t rx_buffer_head;
 static volatile uint8_t rx_buffer_tail;
 
+// Receive error counts
+static volatile uint16_t rx_frame_errors;
+static volatile uint16_t rx_overruns;
+static volatile uint16_t rx_overflows;
+
 ////////////////////////////////////////////
 /// Class members
 ////////////////////////////////////////////
@@ -131,6 +132,33 @@ void MultidropDataUart::flush() {
   while (!(UART0_UCSRA & (1 << UART0_TXC)));
 }
 
+// Receive error counts
+uint16_t MultidropDataUart::getFrameErrors() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return rx_frame_errors;
+  }
+}
+
+uint16_t MultidropDataUart::getOverruns() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return rx_overruns;
+  }
+}
+
+uint16_t MultidropDataUart::getRxOverflows() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return rx_overflows;
+  }
+}
+
+void MultidropDataUart::resetErrors() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    rx_frame_errors = 0;
+    rx_overruns = 0;
+    rx_overflows = 0;
+  }
+}
+
 // Not implemented
 void MultidropDataUart::enable_write() { }
 void MultidropDataUart::enable_read() { }
@@ -141,12 +169,26 @@ void MultidropDataUart::enable_read() { }
 
 // Receive the byte out of the RX register
 void uartReceive() {
+  // Error flags need to be read before the data register
+  uint8_t status = UART0_UCSRA;
+  uint8_t b = UART0_UDR;
+
+  if ((status & (1 << UART0_FE)) && rx_frame_errors < 0xFFFF) {
+    rx_frame_errors++;
+  }
+  if ((status & (1 << UART0_DOR)) && rx_overruns < 0xFFFF) {
+    rx_overruns++;
+  }
+
   // RX buffer full, not taking on new bytes
   if (RX_BUFFER_FULL()) {
+    if (rx_overflows < 0xFFFF) {
+      rx_overflows++;
+    }
     return;
   }
 
-  rx_buffer[rx_buffer_head] = UART0_UDR;
+  rx_buffer[rx_buffer_head] = b;
   rx_buffer_head = (rx_buffer_head + 1) % UART0_RX_BUFFER_SIZE;
 }
 
@@ -177,7 +219,9 @@ void writeByteToRegister(uint8_t b) {
 
 // Received a byte from the RX line
 ISR(USART_RX_vect){
+  TRACE_BEGIN(RX_ISR);
   uartReceive();
+  TRACE_END(RX_ISR);
 }
 
 // Ready to send a byte on the TX line
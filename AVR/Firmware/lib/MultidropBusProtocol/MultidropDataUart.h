@@ -5,6 +5,14 @@
 #include "MultidropData.h"
 #include <avr/io.h>
 
+#ifndef UART0_RX_BUFFER_SIZE
+#define UART0_RX_BUFFER_SIZE 150
+#endif
+
+#ifndef UART0_TX_BUFFER_SIZE
+#define UART0_TX_BUFFER_SIZE 60
+#endif
+
 class MultidropDataUart : public MultidropData {
 public:
   MultidropDataUart();
@@ -28,6 +36,14 @@ public:
   // Clears the RX buffer
   void clear();
 
+  // Receive error counts, since the last resetErrors()
+  uint16_t getFrameErrors(); // Bytes with a framing error (FE0)
+  uint16_t getOverruns();    // Bytes lost because the receive register wasn't read in time (DOR0)
+  uint16_t getRxOverflows(); // Bytes dropped because the RX buffer was full
+
+  // Reset the receive error counts
+  void resetErrors();
+
   // Not implemented
   void enable_write();
   void enable_read();
@@ -1,20 +1,51 @@
 
 #include <util/crc16.h>
+#include <string.h>
 
 #include "MultidropMaster.h"
 
 #define BATCH_FLAG            0b00000001
 #define RESPONSE_MESSAGE_FLAG 0b00000010
+#define RANGE_FLAG            0b00000100
+#define CLASS_FLAG            0b00001000
+#define EXT_FLAG              0b00010000
 
 MultidropMaster::MultidropMaster(MultidropData *serial) : Multidrop(serial) {
   state = EOM;
   nodeNum = 0;
+  bulkSize = 0;
+  bulkChunkLen = 0;
+  batchStart = 1;
+  batchCount = 0;
+  extended = false;
+  berSeed = 1;
+  berFramesSent = 0;
+  baudIndex = MD_BAUD_250K;
+  prevBaudIndex = MD_BAUD_250K;
+  features = 0xFF;
 }
 
-void MultidropMaster::setNodeLength(uint8_t num) {
+void MultidropMaster::setNodeLength(uint16_t num) {
   nodeNum = num;
 }
 
+void MultidropMaster::setExtendedHeaders(uint8_t enabled) {
+  extended = enabled;
+}
+
+uint8_t MultidropMaster::usingExtendedHeaders() {
+  return extended;
+}
+
+#ifdef MD_STATIC_DAISY
+void MultidropMaster::addNextDaisyChain() {
+  setDaisyLineOutput(1);
+  setDaisyLineLevel(1, 1);
+
+  daisy_prev = 0;
+  daisy_next = 1;
+}
+#else
 void MultidropMaster::addNextDaisyChain(volatile uint8_t next_pin_num,
                                         volatile uint8_t* next_ddr_register,
                                         volatile uint8_t* next_port_register,
@@ -31,9 +62,10 @@ void MultidropMaster::addNextDaisyChain(volatile uint8_t next_pin_num,
   daisy_prev = 0;
   daisy_next = 1;
 }
+#endif
 
 uint8_t MultidropMaster::startMessage(uint8_t command,
-                                      uint8_t destinationAddr,
+                                      uint16_t destinationAddr,
                                       uint8_t dataLen,
                                       uint8_t batchMode,
                                       uint8_t responseMessage) {
@@ -43,34 +75,145 @@ uint8_t MultidropMaster::startMessage(uint8_t command,
   dataLength = dataLen;
   destAddress = destinationAddr;
 
+  batchStart = (batchMode) ? 1 : destAddress;
+  batchCount = (batchMode) ? nodeNum : 1;
+
   uint8_t flags = 0;
   if (batchMode) {
     flags |= BATCH_FLAG;
   }
   if (responseMessage) {
     flags |= RESPONSE_MESSAGE_FLAG;
+  }
+
+  sendHeader(flags, command, nodeNum);
+  return 1;
+}
+
+uint8_t MultidropMaster::startRangeMessage(uint8_t command,
+                                           uint16_t first,
+                                           uint16_t count,
+                                           uint8_t dataLen,
+                                           uint8_t responseMessage) {
+  if (first == BROADCAST_ADDRESS || count == 0) return 0;
+  if (!(features & MD_FEATURE_RANGE)) return 0;
+
+  state = 0;
+  messageCRC = ~0;
+  dataLength = dataLen;
+  destAddress = first;
+  batchStart = first;
+  batchCount = count;
+
+  uint8_t flags = BATCH_FLAG | RANGE_FLAG;
+  if (responseMessage) {
+    flags |= RESPONSE_MESSAGE_FLAG;
+  }
+
+  sendHeader(flags, command, count);
+  return 1;
+}
+
+uint8_t MultidropMaster::startDirtyBatch(uint8_t command, uint8_t dataLen, uint8_t *dirty, uint8_t responseMessage) {
+  uint16_t first = 0, last = 0;
+
+  // Find the first and last changed node
+  for (uint32_t addr = 1; addr <= nodeNum; addr++) {
+    uint16_t i = addr - 1;
+    if (dirty[i >> 3] & (1 << (i & 7))) {
+      if (!first) first = addr;
+      last = addr;
+    }
+  }
+
+  if (!first) return 0;
+
+  // The range header is the same size as a batch header, so any range
+  // smaller than the full bus is a win (if every node can parse it)
+  if ((features & MD_FEATURE_RANGE) && (first > 1 || last < nodeNum)) {
+    return startRangeMessage(command, first, last - first + 1, dataLen, responseMessage);
+  }
+  return startMessage(command, BROADCAST_ADDRESS, dataLen, true, responseMessage);
+}
+
+uint8_t MultidropMaster::startClassMessage(uint8_t command, uint8_t numClasses, uint16_t *counts, uint8_t *lengths) {
+  if (!(features & MD_FEATURE_CLASS)) return 0;
+
+  state = 0;
+  messageCRC = ~0;
+  destAddress = BROADCAST_ADDRESS;
+  batchStart = 1;
+  batchCount = 0;
+
+  // Header
+  serial->enable_write();
+  sendByte(0xFF, false, false);
+  sendByte(0xFF, false, false);
+  sendByte(BATCH_FLAG | CLASS_FLAG | ((extended) ? EXT_FLAG : 0));
+  sendAddress(destAddress);
+  sendByte(command);
+  sendByte(numClasses);
+
+  // Class table
+  for (uint8_t i = 0; i < numClasses; i++) {
+    sendAddress(counts[i]);
+    sendByte(lengths[i]);
+    batchCount += counts[i];
+  }
+  serial->enable_read();
+
+  state = HEADER_SENT;
+  return 1;
+}
+
+void MultidropMaster::setNodeClass(uint16_t address, uint8_t nodeClass, uint16_t index) {
+  if (index > 0xFF) {
+    startMessage(CMD_SET_CLASS, address, 3);
+    sendData(nodeClass);
+    sendData(index >> 8);
+    sendData(index & 0xFF);
+  } else {
+    startMessage(CMD_SET_CLASS, address, 2);
+    sendData(nodeClass);
+    sendData(index);
+  }
+  finishMessage();
+}
+
+uint16_t MultidropMaster::getBatchStart() {
+  return batchStart;
+}
 
-    // Don't timeout on first check
+uint16_t MultidropMaster::getBatchCount() {
+  return batchCount;
+}
+
+void MultidropMaster::sendHeader(uint8_t flags, uint8_t command, uint16_t numNodes) {
+  if (extended) {
+    flags |= EXT_FLAG;
+  }
+
+  // Don't timeout on first check
+  if (flags & RESPONSE_MESSAGE_FLAG) {
     dontTimeout = true;
   }
 
   // Start sending header
   serial->enable_write();
-  sendByte(0xFF);
-  sendByte(0xFF);
+  sendByte(0xFF, false, false);
+  sendByte(0xFF, false, false);
   sendByte(flags);
-  sendByte(destAddress);
+  sendAddress(destAddress);
   sendByte(command);
 
   // Length
-  if (batchMode) {
-    sendByte(nodeNum);
+  if (flags & BATCH_FLAG) {
+    sendAddress(numNodes);
   }
   sendByte(dataLength);
   serial->enable_read();
 
   state = HEADER_SENT;
-  return 1;
 }
 
 void MultidropMaster::resetAllNodes() {
@@ -78,10 +221,12 @@ void MultidropMaster::resetAllNodes() {
   finishMessage();
 }
 
-void MultidropMaster::startAddressing(uint32_t time, uint32_t timeout) {
+void MultidropMaster::startAddressing(uint32_t time, uint32_t timeout, uint8_t extendedAddr) {
+  extended = extendedAddr;
   nodeNum = 0;
   lastAddressReceived = 0;
   nodeAddressTries = 0;
+  addrBytes = 0;
   addrTimeoutDuration = timeout;
   timeoutTime = time + addrTimeoutDuration;
 
@@ -91,7 +236,7 @@ void MultidropMaster::startAddressing(uint32_t time, uint32_t timeout) {
 
   // First address
   setNextDaisyValue(1);
-  sendByte(0x00, true);
+  sendAddress(0x00, true);
 
   // Don't timeout on first check
   dontTimeout = true;
@@ -107,7 +252,7 @@ void MultidropMaster::setResponseSettings(uint8_t *buff, uint32_t time, uint32_t
   if (destAddress == BROADCAST_ADDRESS) {
     waitingOnNodes = nodeNum;
   } else {
-    waitingOnNodes = 1;
+    waitingOnNodes = batchCount;
   }
 }
 
@@ -163,6 +308,7 @@ uint8_t MultidropMaster::checkForResponses(uint32_t time) {
 
 MultidropMaster::adr_state_t MultidropMaster::checkForAddresses(uint32_t time) {
   uint8_t b;
+  uint16_t maxAddr = (extended) ? 0xFFFF : 0xFF;
 
   if (dontTimeout) {
     timeoutTime = time + addrTimeoutDuration;
@@ -182,14 +328,25 @@ MultidropMaster::adr_state_t MultidropMaster::checkForAddresses(uint32_t time) {
     dontTimeout = true; // skip timing out next call
     while (serial->available()) {
       b = serial->read();
+      addrReceived = (addrReceived << 8) | b;
+      addrBytes++;
+    }
+
+    // Wait for the rest of an extended address
+    if (extended && addrBytes < 2) {
+      return ADR_WAITING;
     }
+    if (!extended) {
+      addrReceived &= 0xFF;
+    }
+    addrBytes = 0;
 
     // Verify it's 1 larger than the last address and send confirmation
-    if (b == lastAddressReceived + 1) {
+    if (addrReceived == lastAddressReceived + 1) {
       nodeNum++;
-      lastAddressReceived = b;
+      lastAddressReceived = addrReceived;
       nodeAddressTries = 0;
-      sendByte(b, true);
+      sendAddress(addrReceived, true);
     }
     // Invalid address
     else {
@@ -202,8 +359,8 @@ MultidropMaster::adr_state_t MultidropMaster::checkForAddresses(uint32_t time) {
       // Send last valid address again
       else {
         serial->enable_write();
-        sendByte(0x00);
-        sendByte(lastAddressReceived);
+        sendAddress(0x00);
+        sendAddress(lastAddressReceived);
         serial->enable_read();
       }
     }
@@ -221,7 +378,7 @@ MultidropMaster::adr_state_t MultidropMaster::checkForAddresses(uint32_t time) {
   }
 
   // Max nodes
-  if (lastAddressReceived == 255) {
+  if (lastAddressReceived == maxAddr) {
     finishMessage();
     return ADR_DONE;
   }
@@ -248,6 +405,364 @@ uint8_t MultidropMaster::sendData(uint8_t *data, uint16_t len) {
   return 1;
 }
 
+uint8_t MultidropMaster::startBulk(uint16_t size, uint8_t chunkSize, uint8_t stream, uint16_t destination) {
+  if (chunkSize == 0) return 0;
+
+  bulkSize = size;
+  bulkChunkLen = chunkSize;
+
+  startMessage(CMD_BULK_START, destination, 4);
+  sendData(size >> 8);
+  sendData(size & 0xFF);
+  sendData(chunkSize);
+  sendData(stream);
+  return finishMessage();
+}
+
+uint16_t MultidropMaster::bulkChunkCount() {
+  if (bulkChunkLen == 0) return 0;
+  return (bulkSize + bulkChunkLen - 1) / bulkChunkLen;
+}
+
+uint8_t MultidropMaster::sendBulkChunk(uint16_t seq, uint8_t *data, uint16_t destination) {
+  uint16_t offset = (uint32_t)seq * bulkChunkLen;
+  if (offset >= bulkSize) return 0;
+
+  uint16_t remaining = bulkSize - offset;
+  uint8_t len = (remaining < bulkChunkLen) ? remaining : bulkChunkLen;
+
+  startMessage(CMD_BULK_DATA, destination, len + 2);
+  sendData(seq >> 8);
+  sendData(seq & 0xFF);
+  sendData(&data[offset], len);
+  return finishMessage();
+}
+
+uint16_t MultidropMaster::bulkNextSequence(uint8_t *responses, uint16_t nodes) {
+  uint16_t next = bulkChunkCount();
+
+  for (uint16_t i = 0; i < nodes; i++) {
+    uint8_t *status = &responses[(uint32_t)i * 3];
+    uint16_t seq = (status[0] << 8) | status[1];
+
+    if (status[2] != BULK_ERROR && seq < next) {
+      next = seq;
+    }
+  }
+  return next;
+}
+
+void MultidropMaster::sendAddress(uint16_t value, uint8_t directionCntrl) {
+  if (directionCntrl) serial->enable_write();
+  if (extended) {
+    sendByte(value >> 8);
+  }
+  sendByte(value & 0xFF);
+  if (directionCntrl) serial->enable_read();
+}
+
+uint8_t MultidropMaster::minProtocolVersion(uint8_t *responses, uint16_t nodes) {
+  uint8_t version = 0xFF;
+
+  for (uint16_t i = 0; i < nodes; i++) {
+    if (responses[i] < version) {
+      version = responses[i];
+    }
+  }
+  return version;
+}
+
+void MultidropMaster::combineCapabilities(uint8_t *responses, uint16_t nodes, md_caps_t *caps) {
+  caps->version = 0xFF;
+  caps->features = 0xFF;
+  caps->bauds = 0xFF;
+  caps->appFeatures = 0xFF;
+  caps->maxDataLen = 0xFF;
+  caps->bulkChunkLen = 0xFF;
+  caps->rxBufferLen = 0xFF;
+
+  for (uint16_t i = 0; i < nodes; i++) {
+    uint8_t *node = &responses[(uint32_t)i * MD_CAPS_LEN];
+
+    if (node[0] < caps->version)      caps->version = node[0];
+
+    // Older nodes pass CMD_GET_CAPS to the application, which answers with
+    // whatever was in its buffer, so only trust the version byte
+    if (node[0] < MD_CAPS_PROTOCOL_VERSION) {
+      caps->features = 0;
+      caps->bauds &= (1 << MD_BAUD_250K);
+      caps->appFeatures = 0;
+      caps->maxDataLen = 0;
+      caps->bulkChunkLen = 0;
+      caps->rxBufferLen = 0;
+      continue;
+    }
+
+    caps->features &= node[1];
+    caps->bauds &= node[2];
+    caps->appFeatures &= node[3];
+    if (node[4] < caps->maxDataLen)   caps->maxDataLen = node[4];
+    if (node[5] < caps->bulkChunkLen) caps->bulkChunkLen = node[5];
+    if (node[6] < caps->rxBufferLen)  caps->rxBufferLen = node[6];
+  }
+
+  // Extended headers need every node to be on a new enough protocol
+  if (caps->version < MD_EXT_PROTOCOL_VERSION) {
+    caps->features &= ~MD_FEATURE_EXTENDED;
+  }
+}
+
+uint8_t MultidropMaster::useCapabilities(md_caps_t *caps) {
+  uint8_t baud = fastestBaud(caps->bauds);
+
+  // Range and class messages fall back to batch messages
+  features = caps->features;
+
+  // Only switch to extended headers if we need them
+  if (nodeNum > 0xFF) {
+    setExtendedHeaders((caps->features & MD_FEATURE_EXTENDED) != 0);
+  }
+
+  if (baud != MD_BAUD_NONE && baud != baudIndex && setBaud(baud)) {
+    return baud;
+  }
+  return MD_BAUD_NONE;
+}
+
+uint8_t MultidropMaster::fastestBaud(uint8_t mask) {
+  for (int8_t i = MD_BAUD_COUNT - 1; i >= 0; i--) {
+    if (mask & (1 << i)) {
+      return i;
+    }
+  }
+  return MD_BAUD_NONE;
+}
+
+uint8_t MultidropMaster::setBaud(uint8_t index) {
+  uint32_t rate = baudRate(index);
+  if (!rate) return 0;
+
+  sendSetBaud(index);
+  serial->begin(rate);
+
+  prevBaudIndex = baudIndex;
+  baudIndex = index;
+  return 1;
+}
+
+uint8_t MultidropMaster::checkBaud(uint8_t *responses, uint16_t nodes) {
+  uint16_t i;
+
+  for (i = 0; i < nodes; i++) {
+    if (responses[i] == 0) break;
+  }
+  if (i == nodes) {
+    return 1;
+  }
+
+  // Nodes that switched hear this at the new rate, then the rest hear it
+  // at the old one (in case their switch message got through late)
+  sendSetBaud(prevBaudIndex);
+  serial->begin(baudRate(prevBaudIndex));
+  sendSetBaud(prevBaudIndex);
+
+  baudIndex = prevBaudIndex;
+  return 0;
+}
+
+uint8_t MultidropMaster::getBaud() {
+  return baudIndex;
+}
+
+void MultidropMaster::sendSetBaud(uint8_t index) {
+  startMessage(CMD_SET_BAUD, BROADCAST_ADDRESS, 1);
+  sendData(index);
+  finishMessage();
+
+  // Wait for the message to go out before switching
+  serial->flush();
+}
+
+uint8_t MultidropMaster::berStart(uint16_t seed, uint8_t baud, uint16_t frames, uint8_t len) {
+  uint32_t testBytes = (uint32_t)frames * berFrameBytes(len);
+  uint32_t rate = baudRate(baud);
+
+  if (!rate || testBytes == 0 || testBytes > 0xFFFFFF) return 0;
+
+  berSeed = (seed) ? seed : 1;
+  berFramesSent = 0;
+
+  startMessage(CMD_BER_START, BROADCAST_ADDRESS, 6);
+  sendData(berSeed >> 8);
+  sendData(berSeed & 0xFF);
+  sendData(baud);
+  sendData(testBytes >> 16);
+  sendData((testBytes >> 8) & 0xFF);
+  sendData(testBytes & 0xFF);
+  finishMessage();
+
+  // Wait for the message to go out before switching
+  serial->flush();
+  serial->begin(rate);
+  return 1;
+}
+
+uint8_t MultidropMaster::berFinish() {
+  serial->enable_write();
+  for (uint8_t i = 0; i < MD_BER_PAD_LEN; i++) {
+    serial->write(0);
+  }
+  serial->enable_read();
+
+  serial->flush();
+  serial->begin(baudRate(baudIndex));
+  return 1;
+}
+
+uint16_t MultidropMaster::berFrameBytes(uint8_t len) {
+  // Start of message, flags, address, command, length, data and CRC
+  return 2 + 1 + ((extended) ? 2 : 1) + 1 + 1 + len + 2;
+}
+
+uint8_t MultidropMaster::berSendFrame(uint8_t len) {
+  uint16_t pattern = berSeed;
+
+  startMessage(CMD_BER_DATA, BROADCAST_ADDRESS, len);
+  serial->enable_write();
+  for (uint8_t i = 0; i < len; i++) {
+    sendByte(berNext(&pattern));
+  }
+  serial->enable_read();
+  state = DATA_SENDING;
+
+  berFramesSent++;
+  return finishMessage();
+}
+
+uint16_t MultidropMaster::getBerFramesSent() {
+  return berFramesSent;
+}
+
+void MultidropMaster::berResult(uint8_t *responses, uint16_t node, md_ber_t *result) {
+  uint8_t *r = &responses[(uint32_t)node * MD_BER_STATUS_LEN];
+
+  result->frames = (r[0] << 8) | r[1];
+  result->bytes = ((uint32_t)r[2] << 24) | ((uint32_t)r[3] << 16) | ((uint16_t)r[4] << 8) | r[5];
+  result->byteErrors = (r[6] << 8) | r[7];
+  result->bitErrors = (r[8] << 8) | r[9];
+}
+
+uint8_t MultidropMaster::bootEnter() {
+  startMessage(CMD_BOOT_ENTER, BROADCAST_ADDRESS);
+  finishMessage();
+
+  // Wait for the message to go out before switching
+  serial->flush();
+  serial->begin(baudRate(MD_BAUD_250K));
+  return 1;
+}
+
+uint8_t MultidropMaster::bootStart(uint8_t pages, uint16_t imageCrc) {
+  if (pages == 0 || pages > BOOT_MAX_PAGES) return 0;
+
+  startMessage(CMD_BOOT_START, BROADCAST_ADDRESS, 3);
+  sendData(pages);
+  sendData(imageCrc >> 8);
+  sendData(imageCrc & 0xFF);
+  return finishMessage();
+}
+
+uint16_t MultidropMaster::bootMakePatch(uint8_t *base, uint8_t basePages, uint8_t *image, uint8_t pages, uint8_t *patch) {
+  uint16_t imageCrc = bootCrc(image, (uint16_t)pages * BOOT_PAGE_SIZE);
+  uint16_t baseCrc = bootCrc(base, (uint16_t)basePages * BOOT_PAGE_SIZE);
+  uint16_t len = BOOT_PATCH_HEADER_LEN;
+  uint8_t *changed = &patch[6];
+
+  patch[0] = pages;
+  patch[1] = imageCrc >> 8;
+  patch[2] = imageCrc & 0xFF;
+  patch[3] = basePages;
+  patch[4] = baseCrc >> 8;
+  patch[5] = baseCrc & 0xFF;
+  memset(changed, 0, BOOT_MAX_PAGES / 8);
+
+  // Pages past the end of the base are always new
+  for (uint8_t p = 0; p < pages; p++) {
+    uint8_t *page = &image[(uint16_t)p * BOOT_PAGE_SIZE];
+
+    if (p >= basePages || memcmp(page, &base[(uint16_t)p * BOOT_PAGE_SIZE], BOOT_PAGE_SIZE)) {
+      changed[p >> 3] |= (1 << (p & 0x07));
+      memcpy(&patch[len], page, BOOT_PAGE_SIZE);
+      len += BOOT_PAGE_SIZE;
+    }
+  }
+  return len;
+}
+
+uint8_t MultidropMaster::bootStartPatch(uint8_t *patch) {
+  if (patch[0] == 0 || patch[0] > BOOT_MAX_PAGES) return 0;
+
+  startMessage(CMD_BOOT_PATCH, BROADCAST_ADDRESS, BOOT_PATCH_HEADER_LEN);
+  sendData(patch, BOOT_PATCH_HEADER_LEN);
+  return finishMessage();
+}
+
+uint8_t* MultidropMaster::bootPatchPage(uint8_t *patch, uint8_t num) {
+  uint8_t *changed = &patch[6];
+  uint16_t offset = BOOT_PATCH_HEADER_LEN;
+
+  if (!(changed[num >> 3] & (1 << (num & 0x07)))) return 0;
+
+  // Skip the changed pages before this one
+  for (uint8_t p = 0; p < num; p++) {
+    if (changed[p >> 3] & (1 << (p & 0x07))) {
+      offset += BOOT_PAGE_SIZE;
+    }
+  }
+  return &patch[offset];
+}
+
+uint8_t MultidropMaster::bootSendPage(uint8_t num, uint8_t *page) {
+  uint16_t crc = bootCrc(page, BOOT_PAGE_SIZE);
+
+  startMessage(CMD_BOOT_PAGE, BROADCAST_ADDRESS, 3 + BOOT_PAGE_SIZE);
+  sendData(num);
+  sendData(crc >> 8);
+  sendData(crc & 0xFF);
+  sendData(page, BOOT_PAGE_SIZE);
+  return finishMessage();
+}
+
+uint8_t MultidropMaster::bootFinish() {
+  startMessage(CMD_BOOT_FINISH, BROADCAST_ADDRESS);
+  return finishMessage();
+}
+
+uint8_t MultidropMaster::bootNextMissing(uint8_t *responses, uint16_t nodes, uint8_t pages, uint8_t from) {
+  uint8_t len = BOOT_STATUS_LEN(pages);
+  uint8_t next = pages;
+
+  for (uint16_t n = 0; n < nodes; n++) {
+    uint8_t *r = &responses[(uint32_t)n * len];
+    if (r[0] != BOOT_RECEIVING) continue;
+
+    for (uint8_t p = from; p < next; p++) {
+      if (r[1 + (p >> 3)] & (1 << (p & 0x07))) {
+        next = p;
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+uint16_t MultidropMaster::bootCrc(uint8_t *data, uint16_t len, uint16_t crc) {
+  for (uint16_t i = 0; i < len; i++) {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
 void MultidropMaster::sendByte(uint8_t b, uint8_t directionCntrl, uint8_t updateCRC) {
   if (directionCntrl) serial->enable_write();
   serial->write(b);
@@ -266,16 +781,16 @@ uint8_t MultidropMaster::finishMessage() {
   // Send NULL message to end the addressing stage
   if (state == ADDRESSING) {
 
-    // If the last address is 255, we've already sent 0xFF twice
-    if (lastAddressReceived < 0xFF) {
-      sendByte(0xFF);
-      sendByte(0xFF);
+    // If the last address is the max, we've already sent it twice
+    if (lastAddressReceived < ((extended) ? 0xFFFF : 0xFF)) {
+      sendAddress(0xFFFF);
+      sendAddress(0xFFFF);
     }
 
     // Send null message, just in case
     messageCRC = ~0;
-    sendByte(0x00);     // flags
-    sendByte(0x00);     // broadcast address
+    sendByte((extended) ? EXT_FLAG : 0x00); // flags
+    sendAddress(BROADCAST_ADDRESS);
     sendByte(CMD_NULL); // command
     sendByte(0);        // length
   }
@@ -6,12 +6,25 @@
 #include <avr/io.h>
 #include <stdint.h>
 #include "Multidrop.h"
+#include "MultidropBoot.h"
 
 // How many times master will try to get a node's address, before deciding it is done
 #ifndef MD_MASTER_ADDR_MAX_TRIES
 #define MD_MASTER_ADDR_MAX_TRIES 4
 #endif
 
+// How long to wait after setBaud() before checking the nodes (see setBaud()).
+// Nodes switch when their main loop next reads the bus, which can be after
+// a touch sensor read.
+#ifndef MD_BAUD_SETTLE_US
+#define MD_BAUD_SETTLE_US 20000
+#endif
+
+// Bytes sent after a bit error rate test, so nodes that lost some still get to its end
+#ifndef MD_BER_PAD_LEN
+#define MD_BER_PAD_LEN 32
+#endif
+
 class MultidropMaster: public Multidrop {
 
 public:
@@ -20,28 +33,79 @@ public:
     ADR_DONE,
     ADR_ERROR
   };
-  uint8_t nodeNum;
+  uint16_t nodeNum;
 
   MultidropMaster(MultidropData *_serial);
 
   // Set the number of nodes on the bus
-  void setNodeLength(uint8_t);
+  void setNodeLength(uint16_t);
+
+  // Use extended headers, with 16-bit addresses and node counts, for all messages.
+  // Only turn this on when every node supports it (see minProtocolVersion()).
+  void setExtendedHeaders(uint8_t enabled);
+
+  // Are extended headers being used
+  uint8_t usingExtendedHeaders();
 
   // Add the pin and registers for the next daisy chain line
   // This is for master nodes that only have an out line and the
   // bus does not come back around to master
+  // (with MD_STATIC_DAISY, MD_DAISY1_PIN is the next line)
+#ifdef MD_STATIC_DAISY
+  void addNextDaisyChain();
+#else
   void addNextDaisyChain(volatile uint8_t next_pin_num,
                          volatile uint8_t* next_ddr_register,
                          volatile uint8_t* next_port_register,
                          volatile uint8_t* next_pin_register);
+#endif
 
   // Start a new message to send
   uint8_t startMessage(uint8_t command,
-                      uint8_t destination=BROADCAST_ADDRESS,
+                      uint16_t destination=BROADCAST_ADDRESS,
                       uint8_t dataLength=0,
                       uint8_t batchMode=false,
                       uint8_t responseMessage=false);
 
+  // Start a batch message that only covers `count` nodes, starting at address `first`.
+  // Nodes outside of the range skip the message.
+  // Returns 0, and doesn't start a message, if not every node supports range
+  // messages (see useCapabilities()).
+  uint8_t startRangeMessage(uint8_t command,
+                            uint16_t first,
+                            uint16_t count,
+                            uint8_t dataLength,
+                            uint8_t responseMessage=false);
+
+  // Start a batch message for only the nodes that have changed.
+  //   * dirty: Bitmap with one bit per node (address 1 is bit 0 of the first byte).
+  // If the changed nodes are clustered, and every node supports range messages,
+  // this sends a range message around them, otherwise it's a normal batch
+  // message to all nodes. Use getBatchStart() and
+  // getBatchCount() to know which nodes to send data for.
+  // Returns 0, and doesn't start a message, if no nodes have changed.
+  uint8_t startDirtyBatch(uint8_t command, uint8_t dataLength, uint8_t *dirty, uint8_t responseMessage=false);
+
+  // Start a batch message where each node class has its own slot length.
+  //   * numClasses: Number of node classes
+  //   * counts: Number of nodes in each class
+  //   * lengths: Slot length for each class
+  // Send the data for every node of class 0 (in class index order), then class 1, and so on.
+  // Nodes are given their class and index with setNodeClass().
+  // This is only for sending data to nodes, not for response messages.
+  // Returns 0, and doesn't start a message, if not every node supports class
+  // messages (see useCapabilities()). Send a normal batch message instead.
+  uint8_t startClassMessage(uint8_t command, uint8_t numClasses, uint16_t *counts, uint8_t *lengths);
+
+  // Set a node's class and its index within that class
+  void setNodeClass(uint16_t address, uint8_t nodeClass, uint16_t index);
+
+  // First node address in the current batch message
+  uint16_t getBatchStart();
+
+  // Number of nodes in the current batch message
+  uint16_t getBatchCount();
+
   // Send a reset message to all nodes, which tells them to forget their address and
   // drop their daisy lines to low.
   void resetAllNodes();
@@ -51,7 +115,9 @@ public:
   //   * time: The current system time (used for timeout).
   //   * timeout: (optional) How long master will wait for each node to respond (based on time units).
   //              You will need to call checkForAddresses frequently to check for responses and timeout nodes
-  void startAddressing(uint32_t time, uint32_t timeout=10);
+  //   * extended: (optional) Use 16-bit addresses, for more than 255 nodes. Every node must support
+  //               extended headers, so address normally first and check minProtocolVersion().
+  void startAddressing(uint32_t time, uint32_t timeout=10, uint8_t extended=false);
 
   // Check for new addresses received
   adr_state_t checkForAddresses(uint32_t time);
@@ -81,6 +147,143 @@ public:
   // Send the message
   uint8_t finishMessage();
 
+  // Bulk transfers send a block of data, larger than a node's message buffer,
+  // as a series of chunks which each have their own CRC:
+  //
+  //   1. startBulk() to tell the nodes the size, chunk size and stream ID.
+  //   2. sendBulkChunk() for the next window of chunks (several in a row, without waiting).
+  //   3. Batch response message with CMD_BULK_STATUS (3 bytes per node) and
+  //      bulkNextSequence() to find the first chunk that a node is still missing.
+  //   4. Repeat from 2, starting at that chunk, until it reaches the final chunk count.
+  //
+  // Nodes drop any chunk that isn't the next one they need, so lost or corrupted
+  // chunks are simply sent again from the last acknowledged point.
+  uint8_t startBulk(uint16_t size, uint8_t chunkSize, uint8_t stream=0, uint16_t destination=BROADCAST_ADDRESS);
+
+  // Send one bulk chunk. The data is the whole bulk buffer, the chunk is picked by sequence number.
+  uint8_t sendBulkChunk(uint16_t seq, uint8_t *data, uint16_t destination=BROADCAST_ADDRESS);
+
+  // Number of chunks in the current bulk transfer
+  uint16_t bulkChunkCount();
+
+  // From a buffer of CMD_BULK_STATUS responses, get the lowest sequence number
+  // any node still needs. Nodes in the BULK_ERROR state are skipped.
+  uint16_t bulkNextSequence(uint8_t *responses, uint16_t nodes);
+
+  // From a buffer of CMD_GET_PROTOCOL responses (1 byte per node), get the
+  // lowest protocol version on the bus. Extended headers can be used if this
+  // is at least MD_EXT_PROTOCOL_VERSION.
+  uint8_t minProtocolVersion(uint8_t *responses, uint16_t nodes);
+
+  // Capability discovery:
+  //
+  //   1. Batch response message with CMD_GET_CAPS (MD_CAPS_LEN bytes per node).
+  //      Use all zeros as the default response, so older nodes that don't
+  //      answer turn off every optional feature. Nodes older than
+  //      MD_CAPS_PROTOCOL_VERSION count as no features and the base baud rate,
+  //      whatever they answered.
+  //   2. combineCapabilities() to get what the whole bus supports.
+  //   3. useCapabilities() to switch to the fastest of those settings.
+
+  // Combine the CMD_GET_CAPS responses for all nodes into the capabilities every node shares
+  void combineCapabilities(uint8_t *responses, uint16_t nodes, md_caps_t *caps);
+
+  // Switch the bus to the fastest settings in the combined capabilities, and
+  // only use the range and class messages every node supports.
+  // Returns the baud rate index that was selected (MD_BAUD_NONE if the rate did not change).
+  // Then check the switch, like after setBaud().
+  uint8_t useCapabilities(md_caps_t *caps);
+
+  // Get the fastest baud rate in a mask of baud rates (MD_BAUD_NONE if there are none)
+  static uint8_t fastestBaud(uint8_t mask);
+
+  // Tell every node to switch baud rate and then switch the master's serial port.
+  // A node that misses the message is left at the old rate, so check the switch:
+  //
+  //   1. setBaud() to the new rate.
+  //   2. Wait MD_BAUD_SETTLE_US.
+  //   3. Batch response message with CMD_GET_PROTOCOL (1 byte per node),
+  //      with 0 as the default response.
+  //   4. checkBaud() with the responses. If any node didn't answer, the whole
+  //      bus goes back to the previous rate.
+  uint8_t setBaud(uint8_t index);
+
+  // Check the CMD_GET_PROTOCOL responses after setBaud(). Returns 1 if every node
+  // answered at the new rate. If not, switches every node and the master back to
+  // the previous rate and returns 0.
+  uint8_t checkBaud(uint8_t *responses, uint16_t nodes);
+
+  // Baud rate index the bus is running at (MD_BAUD_*)
+  uint8_t getBaud();
+
+  // Bit error rate test, for each baud rate to try:
+  //
+  //   1. berStart() with the rate to test and how many frames of what length
+  //      will be sent. The test has a set length, after which the nodes go back
+  //      to the current rate on their own, so they can always be asked for
+  //      their results, however bad the link was.
+  //   2. Wait MD_BAUD_SETTLE_US.
+  //   3. berSendFrame() that many times. Nodes check every byte against
+  //      the same pattern generator, even when the frame fails its CRC check.
+  //   4. berFinish() to end the test and switch the master back.
+  //   5. Wait MD_BAUD_SETTLE_US.
+  //   6. Batch response message with CMD_BER_STATUS (MD_BER_STATUS_LEN bytes per node),
+  //      and berResult() to decode each node's counts. Nodes that saw fewer
+  //      frames than getBerFramesSent() lost whole frames. A node that lost more
+  //      than MD_BER_PAD_LEN bytes only gets back during this message, so ask
+  //      again for any node that didn't answer.
+  uint8_t berStart(uint16_t seed, uint8_t baud, uint16_t frames, uint8_t len);
+
+  // End the test with MD_BER_PAD_LEN bytes of padding, and switch back to the current rate
+  uint8_t berFinish();
+
+  // Send one test frame with `len` pattern bytes
+  uint8_t berSendFrame(uint8_t len);
+
+  // Number of test frames sent since berStart()
+  uint16_t getBerFramesSent();
+
+  // Decode one node's CMD_BER_STATUS response
+  static void berResult(uint8_t *responses, uint16_t node, md_ber_t *result);
+
+  // Firmware update through the bus bootloader (see MultidropBoot.h for the steps).
+  // The image is padded with 0xFF to a whole number of pages.
+
+  // Restart every node into the bootloader and switch to the bootloader's baud rate
+  uint8_t bootEnter();
+
+  // Tell the nodes the size and CRC (see bootCrc()) of the new image
+  uint8_t bootStart(uint8_t pages, uint16_t imageCrc);
+
+  // Build a patch (see BOOT_PATCH_HEADER_LEN) from the base image the nodes are
+  // running to the new image. `patch` needs room for the header and every changed page.
+  // Returns the length of the patch.
+  static uint16_t bootMakePatch(uint8_t *base, uint8_t basePages, uint8_t *image, uint8_t pages, uint8_t *patch);
+
+  // Tell the nodes about a patch, instead of bootStart(). Wait BOOT_PATCH_MS
+  // before sending the changed pages.
+  uint8_t bootStartPatch(uint8_t *patch);
+
+  // Get a changed page from a patch (0 if the page is the same as the base).
+  // Nodes that aren't running the base image need every page, so keep the
+  // full image around to send them whatever else they're missing.
+  static uint8_t* bootPatchPage(uint8_t *patch, uint8_t num);
+
+  // Broadcast one page. `page` points to that page's BOOT_PAGE_SIZE bytes.
+  uint8_t bootSendPage(uint8_t num, uint8_t *page);
+
+  // Check the image on every node and start it
+  uint8_t bootFinish();
+
+  // From a buffer of CMD_BOOT_STATUS responses (BOOT_STATUS_LEN(pages) bytes per node),
+  // get the first page, starting at `from`, that any receiving node is still missing.
+  // Returns `pages` if no node is missing anything.
+  static uint8_t bootNextMissing(uint8_t *responses, uint16_t nodes, uint8_t pages, uint8_t from=0);
+
+  // CRC of image data, as the nodes calculate it. To continue a CRC over
+  // more data, pass in the last result.
+  static uint16_t bootCrc(uint8_t *data, uint16_t len, uint16_t crc=0xFFFF);
+
 private:
   enum State {
     EOM,
@@ -92,19 +295,45 @@ private:
   uint32_t timeoutTime,
            timeoutDuration,
            addrTimeoutDuration;
-  uint16_t responseIndex;
+  uint32_t responseIndex;
+
+  uint16_t bulkSize,
+           destAddress,
+           waitingOnNodes,
+           lastAddressReceived,
+           addrReceived,   // Extended address being received
+           batchStart,
+           batchCount;
 
-  uint8_t  destAddress,
-           dataLength,
+  uint8_t  dataLength,
            state,
            dontTimeout,
-           waitingOnNodes,
            nodeAddressTries,
-           lastAddressReceived;
+           addrBytes,      // Bytes of addrReceived that have been received
+           extended,
+           bulkChunkLen,
+           baudIndex,
+           prevBaudIndex,  // Rate before the last setBaud()
+           features;       // MD_FEATURE_* every node supports
+
+  uint16_t berSeed,
+           berFramesSent;
 
   uint8_t *responseBuff,
           *defaultResponseValues;
 
+  // Send the message header
+  void sendHeader(uint8_t flags, uint8_t command, uint16_t numNodes);
+
+  // Bytes on the wire for one bit error rate test frame
+  uint16_t berFrameBytes(uint8_t len);
+
+  // Broadcast CMD_SET_BAUD and wait for it to go out
+  void sendSetBaud(uint8_t index);
+
+  // Send an address or node count (2 bytes with extended headers)
+  void sendAddress(uint16_t value, uint8_t directionCntrl=0);
+
   // Send a byte and, optionally, update the messageCRC value
   void sendByte(uint8_t b, uint8_t directionCntrl=0, uint8_t updateCRC=1);
 };
@@ -0,0 +1,33 @@
+/**
+ * Compile-time pin descriptors.
+ *
+ * The pin's port and bit are template parameters, so setting, clearing and
+ * reading it compile to single sbi/cbi/sbic instructions and take no RAM,
+ * instead of going through register pointers stored in the object.
+ *
+ *   typedef MdPin<MD_PORTC_IO, PC3> DaisyPin;
+ *   DaisyPin::output();
+ *   DaisyPin::high();
+ */
+
+#ifndef MultidropPins_H
+#define MultidropPins_H
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// I/O addresses of the PINx registers (DDRx and PORTx are the next two registers)
+#define MD_PORTB_IO 0x03
+#define MD_PORTC_IO 0x06
+#define MD_PORTD_IO 0x09
+
+template <uint8_t io, uint8_t bit>
+struct MdPin {
+  static inline void output()  { _SFR_IO8(io + 1) |= (1 << bit); }
+  static inline void input()   { _SFR_IO8(io + 1) &= ~(1 << bit); }
+  static inline void high()    { _SFR_IO8(io + 2) |= (1 << bit); }
+  static inline void low()     { _SFR_IO8(io + 2) &= ~(1 << bit); }
+  static inline uint8_t read() { return (_SFR_IO8(io) & (1 << bit)) != 0; }
+};
+
+#endif
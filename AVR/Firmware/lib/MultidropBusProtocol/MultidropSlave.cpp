@@ -1,5 +1,6 @@
 
 #include "MultidropSlave.h"
+#include "MultidropTrace.h"
 #include <util/crc16.h>
 #include <util/delay.h>
 
@@ -11,7 +12,36 @@ MultidropSlave::MultidropSlave(MultidropData *_serial) : Multidrop(_serial) {
   flags = 0;
   myAddress = 0;
   responseHandler = 0;
+  bulkSink = 0;
+  bulkState = BULK_IDLE;
+  nodeClass = NO_CLASS;
+  classIndex = 0;
+  appFeatures = 0;
+  rxBufferLen = 0;
+  crcErrors = 0;
+  messageCount = 0;
+  berSeed = 1;
+  berFrames = 0;
+  berBytes = 0;
+  berByteErrors = 0;
+  berBitErrors = 0;
+  berRemaining = 0;
+  berReturnBaud = MD_BAUD_250K;
+  baudIndex = MD_BAUD_250K;
   parseState = NO_MESSAGE;
+
+  // Baud rates the UART can reach
+  baudMask = 0;
+  for (uint8_t i = 0; i < MD_BAUD_COUNT; i++) {
+    uint32_t rate = baudRate(i);
+    uint32_t ubrr = (F_CPU + 8UL * rate) / (16UL * rate);
+    uint32_t actual = F_CPU / (16UL * ubrr);
+    uint32_t diff = (actual > rate) ? actual - rate : rate - actual;
+
+    if (ubrr > 0 && diff * 50 < rate) {
+      baudMask |= (1 << i);
+    }
+  }
 }
 
 void MultidropSlave::resetNode() {
@@ -26,13 +56,23 @@ uint8_t MultidropSlave::hasNewMessage() {
 }
 
 uint8_t MultidropSlave::isAddressedToMe() {
-  return hasNewMessage() && (address == myAddress || address == BROADCAST_ADDRESS);
+  if (!hasNewMessage()) return 0;
+
+  // Range and class batch messages only go to nodes with a slot
+  if (flags & (RANGE_FLAG | CLASS_FLAG)) {
+    return inRange;
+  }
+  return address == myAddress || address == BROADCAST_ADDRESS;
 }
 
 uint8_t MultidropSlave::inBatchMode() {
   return flags & BATCH_FLAG;
 }
 
+uint8_t MultidropSlave::isExtended() {
+  return flags & EXT_FLAG;
+}
+
 uint8_t MultidropSlave::isResponseMessage() {
   return flags & RESPONSE_MESSAGE_FLAG;
 }
@@ -49,11 +89,11 @@ uint8_t MultidropSlave::getCommand() {
   return command;
 }
 
-void MultidropSlave::setAddress(uint8_t addr) {
+void MultidropSlave::setAddress(uint16_t addr) {
   myAddress = addr;
 }
 
-uint8_t MultidropSlave::getAddress() {
+uint16_t MultidropSlave::getAddress() {
   return myAddress;
 }
 
@@ -61,17 +101,85 @@ void MultidropSlave::setResponseHandler(multidropResponseFunction handler) {
   responseHandler = handler;
 }
 
+void MultidropSlave::setBulkSink(multidropBulkSink sink) {
+  bulkSink = sink;
+}
+
+uint8_t MultidropSlave::getBulkState() {
+  return bulkState;
+}
+
+void MultidropSlave::setNodeClass(uint8_t cls, uint16_t index) {
+  nodeClass = cls;
+  classIndex = index;
+}
+
+uint8_t MultidropSlave::getNodeClass() {
+  return nodeClass;
+}
+
+uint16_t MultidropSlave::getClassIndex() {
+  return classIndex;
+}
+
+void MultidropSlave::setCapabilities(uint8_t features, uint8_t rxLen) {
+  appFeatures = features;
+  rxBufferLen = rxLen;
+}
+
+void MultidropSlave::setBaudMask(uint8_t mask) {
+  baudMask = mask;
+}
+
+uint8_t MultidropSlave::getBaudMask() {
+  return baudMask;
+}
+
+uint16_t MultidropSlave::getCrcErrors() {
+  return crcErrors;
+}
+
+uint16_t MultidropSlave::getMessageCount() {
+  return messageCount;
+}
+
+void MultidropSlave::resetCounters() {
+  crcErrors = 0;
+  messageCount = 0;
+}
+
+uint16_t MultidropSlave::getBerFrames() {
+  return berFrames;
+}
+
+uint32_t MultidropSlave::getBerBytes() {
+  return berBytes;
+}
+
+uint16_t MultidropSlave::getBerByteErrors() {
+  return berByteErrors;
+}
+
+uint16_t MultidropSlave::getBerBitErrors() {
+  return berBitErrors;
+}
+
 void MultidropSlave::startMessage() {
   flags = 0;
   length = 0;
   address = 0;
   lastAddr = 0xFF;
+  addrHalf = 0;
   dataIndex = 0;
   dataBuffer[0] = '\0';
   fullDataLength = 0;
   fullDataIndex = 0;
   dataStartOffset = 0;
   errCount = 0;
+  firstAddress = 1;
+  inRange = 1;
+  bulkIndex = 0;
+  bulkSeq = 0;
   messageCRC = ~0;
 }
 
@@ -90,12 +198,63 @@ uint8_t MultidropSlave::read() {
 
   // Handle incoming bytes
   while (serial->available()) {
-    if(parse(serial->read()) == 1 && !isResponseMessage()) {
+    TRACE_BEGIN(PARSE);
+    uint8_t parsed = parse(serial->read());
+    TRACE_END(PARSE);
+
+    // The bit error rate test is over, back to the rate from before it
+    if (berRemaining && --berRemaining == 0) {
+      switchBaud(berReturnBaud);
+    }
+
+    if(parsed == 1 && !isResponseMessage()) {
 
       if (command == CMD_RESET) {
         resetNode();
       }
 
+      // Start a new bit error rate test, at the rate being tested (if we support it).
+      // It ends on its own after its length in bytes, even if we lost some frames.
+      if (command == CMD_BER_START && isAddressedToMe() && dataIndex >= 2) {
+        berSeed = (dataBuffer[0] << 8) | dataBuffer[1];
+        if (berSeed == 0) berSeed = 1;
+        berFrames = 0;
+        berBytes = 0;
+        berByteErrors = 0;
+        berBitErrors = 0;
+
+        if (dataIndex >= 6 && berRemaining == 0 &&
+            dataBuffer[2] < MD_BAUD_COUNT && (baudMask & (1 << dataBuffer[2]))) {
+          berRemaining = ((uint32_t)dataBuffer[3] << 16) | ((uint16_t)dataBuffer[4] << 8) | dataBuffer[5];
+          if (berRemaining) {
+            berReturnBaud = baudIndex;
+            switchBaud(dataBuffer[2]);
+          }
+        }
+      }
+
+      // Switch baud rate, if we support it
+      if (command == CMD_SET_BAUD && isAddressedToMe() && dataIndex >= 1 &&
+          dataBuffer[0] < MD_BAUD_COUNT && (baudMask & (1 << dataBuffer[0]))) {
+        switchBaud(dataBuffer[0]);
+      }
+
+      if (command == CMD_SET_CLASS && address == myAddress && myAddress != 0) {
+        if (dataIndex >= 3) {
+          setNodeClass(dataBuffer[0], (dataBuffer[1] << 8) | dataBuffer[2]);
+        } else if (dataIndex == 2) {
+          setNodeClass(dataBuffer[0], dataBuffer[1]);
+        }
+      }
+
+      // Bulk transfers are handled here and don't get passed on.
+      // The next chunk may already be buffered, so be ready to parse it.
+      if (command == CMD_BULK_START || command == CMD_BULK_DATA) {
+        handleBulkMessage();
+        parseState = NO_MESSAGE;
+        continue;
+      }
+
       return 1;
     }
   }
@@ -113,7 +272,11 @@ uint8_t MultidropSlave::parse(uint8_t b) {
   }
   else if (parseState == DATA_SECTION) {
     if (command == CMD_ADDRESS) {
-      processAddressing(b);
+      receiveAddress(b);
+    } else if (command == CMD_BULK_DATA && !inBatchMode()) {
+      processBulkData(b);
+    } else if (command == CMD_BER_DATA && !inBatchMode()) {
+      processBerData(b);
     } else {
       processData(b);
     }
@@ -134,9 +297,11 @@ uint8_t MultidropSlave::parse(uint8_t b) {
     // Validate each byte
     if (crcByte != b) {
       parseState = NO_MESSAGE; // no match, abort
+      if (crcErrors < 0xFFFF) crcErrors++;
     }
     else if (parsePos == EOM2_POS) {
       parseState = MESSAGE_READY;
+      if (messageCount < 0xFFFF) messageCount++;
       return 1;
     }
   }
@@ -169,11 +334,15 @@ void MultidropSlave::parseHeader(uint8_t b) {
     parsePos = HEADER_FLAGS_POS;
     flags = b;
   }
-  // Address
+  // Address (high byte first, for extended headers)
   else if (parsePos == HEADER_FLAGS_POS) {
-    parsePos = HEADER_ADDR_POS;
+    parsePos = (isExtended()) ? HEADER_ADDR_HI_POS : HEADER_ADDR_POS;
     address = b;
   }
+  else if (parsePos == HEADER_ADDR_HI_POS) {
+    parsePos = HEADER_ADDR_POS;
+    address = (address << 8) | b;
+  }
   // Command
   else if (parsePos == HEADER_ADDR_POS) {
     parsePos = HEADER_CMD_POS;
@@ -186,6 +355,13 @@ void MultidropSlave::parseHeader(uint8_t b) {
     // in batch mode, the first length byte is the number of nodes
     if (inBatchMode()) {
       numNodes = b;
+
+      // (the number of classes is always 1 byte)
+      if (isExtended() && !(flags & CLASS_FLAG)) {
+        parsePos = HEADER_LEN1_HI_POS;
+      } else {
+        startBatchHeader();
+      }
     } else {
       length = b;
       fullDataLength = b;
@@ -193,17 +369,38 @@ void MultidropSlave::parseHeader(uint8_t b) {
       parseState = DATA_SECTION;
     }
   }
+  // Number of nodes, low byte (for extended headers)
+  else if (parsePos == HEADER_LEN1_HI_POS) {
+    parsePos = HEADER_LEN1_POS;
+    numNodes = (numNodes << 8) | b;
+    startBatchHeader();
+  }
+  // Class table (if in class batch mode)
+  else if (parsePos == HEADER_CLASS_COUNT_POS ||
+           parsePos == HEADER_CLASS_COUNT_LO_POS ||
+           parsePos == HEADER_CLASS_LEN_POS) {
+    parseClassTable(b);
+  }
   // Length, 2nd byte (if in batch mode)
   else if (parsePos == HEADER_LEN1_POS) {
     length = b;
 
     if (myAddress != 0) {
-      fullDataLength = length * numNodes;
-      dataStartOffset = (myAddress - 1) * length; // Where our data starts in the message
+      fullDataLength = (uint32_t)length * numNodes;
+
+      // Range messages start at the header address, instead of node 1
+      if ((flags & RANGE_FLAG) && address != BROADCAST_ADDRESS) {
+        firstAddress = address;
+      }
+
+      // Nodes outside the range still parse the message, but skip all the data
+      inRange = (myAddress >= firstAddress && myAddress - firstAddress < numNodes);
+      dataStartOffset = (uint32_t)(myAddress - firstAddress) * length; // Where our data starts in the message
     }
     else {
       // We don't have an address, so cannot read message
       length = 0;
+      inRange = 0;
     }
 
     parsePos = HEADER_LEN2_POS;
@@ -213,30 +410,88 @@ void MultidropSlave::parseHeader(uint8_t b) {
   // Finishing header
   if (parseState == DATA_SECTION) {
 
+    // Every test frame starts the pattern over
+    if (command == CMD_BER_DATA) {
+      berState = berSeed;
+      if (berFrames < 0xFFFF) berFrames++;
+    }
+
     // On to addressing
     if (command == CMD_ADDRESS) {
       parsePos = ADDR_WAITING;
     }
 
     // No data, continue to CRC
-    else if (length == 0) {
+    else if (fullDataLength == 0) {
       parsePos = DATA_POS;
       parseState = END_SECTION;
     }
 
     // If in response message and we're the first node, move straight to sending a response
-    else if (isResponseMessage() && myAddress == 1) {
+    else if (isResponseMessage() && inRange && dataStartOffset == 0 && (inBatchMode() || myAddress == 1)) {
       sendResponse();
     }
   }
 }
 
+void MultidropSlave::startBatchHeader() {
+
+  // Class batch messages have the number of classes, followed by the class table
+  if (flags & CLASS_FLAG) {
+    classNum = 0;
+    length = 0;
+    inRange = 0;
+
+    if (numNodes == 0) {
+      parseState = DATA_SECTION;
+    } else {
+      parsePos = HEADER_CLASS_COUNT_POS;
+    }
+  }
+}
+
+void MultidropSlave::parseClassTable(uint8_t b) {
+
+  // Number of nodes in this class (2 bytes for extended headers)
+  if (parsePos == HEADER_CLASS_COUNT_POS) {
+    classNodes = b;
+    parsePos = (isExtended()) ? HEADER_CLASS_COUNT_LO_POS : HEADER_CLASS_LEN_POS;
+    return;
+  }
+  if (parsePos == HEADER_CLASS_COUNT_LO_POS) {
+    classNodes = (classNodes << 8) | b;
+    parsePos = HEADER_CLASS_LEN_POS;
+    return;
+  }
+
+  // Slot length for this class
+  // Our data starts after all the slots for the classes before ours
+  if (classNum < nodeClass) {
+    dataStartOffset += (uint32_t)classNodes * b;
+  }
+  else if (classNum == nodeClass && classIndex < classNodes) {
+    length = b;
+    inRange = 1;
+    dataStartOffset += (uint32_t)classIndex * b;
+  }
+  fullDataLength += (uint32_t)classNodes * b;
+
+  // Done with the table
+  classNum++;
+  if (classNum >= numNodes) {
+    parsePos = HEADER_LEN2_POS;
+    parseState = DATA_SECTION;
+  } else {
+    parsePos = HEADER_CLASS_COUNT_POS;
+  }
+}
+
 void MultidropSlave::processData(uint8_t b) {
   messageCRC = _crc16_update(messageCRC, b);
   parsePos = DATA_POS;
   
   // If we're in our data section, fill data buffer
-  if (fullDataIndex >= dataStartOffset && dataIndex < length){
+  if (inRange && fullDataIndex >= dataStartOffset && dataIndex < length && dataIndex < MD_MAX_DATA_LEN){
     dataBuffer[dataIndex++] = b;
     dataBuffer[dataIndex] = '\0';
   }
@@ -244,7 +499,7 @@ void MultidropSlave::processData(uint8_t b) {
   fullDataIndex++;
 
   // It's our turn to respond with some data
-  if (isResponseMessage() && fullDataIndex == dataStartOffset) {
+  if (isResponseMessage() && inRange && fullDataIndex == dataStartOffset) {
     sendResponse();
     return;
   }
@@ -256,7 +511,149 @@ void MultidropSlave::processData(uint8_t b) {
 }
 
 
-void MultidropSlave::processAddressing(uint8_t b) {
+void MultidropSlave::processBulkData(uint8_t b) {
+  messageCRC = _crc16_update(messageCRC, b);
+  parsePos = DATA_POS;
+
+  // Sequence number, then the chunk
+  if (fullDataIndex == 0) {
+    bulkSeq = b << 8;
+  }
+  else if (fullDataIndex == 1) {
+    bulkSeq |= b;
+  }
+  else if (bulkIndex < MD_BULK_CHUNK_LEN) {
+    bulkBuffer[bulkIndex++] = b;
+  }
+
+  fullDataIndex++;
+  if (fullDataIndex >= fullDataLength) {
+    parseState = END_SECTION;
+  }
+}
+
+void MultidropSlave::processBerData(uint8_t b) {
+  messageCRC = _crc16_update(messageCRC, b);
+  parsePos = DATA_POS;
+
+  // Compare against the pattern, as it's received, so errors are
+  // counted even if the message fails its CRC check
+  uint8_t diff = b ^ berNext(&berState);
+  berBytes++;
+  if (diff) {
+    if (berByteErrors < 0xFFFF) berByteErrors++;
+    while (diff) {
+      if ((diff & 1) && berBitErrors < 0xFFFF) berBitErrors++;
+      diff >>= 1;
+    }
+  }
+
+  fullDataIndex++;
+  if (fullDataIndex >= fullDataLength) {
+    parseState = END_SECTION;
+  }
+}
+
+void MultidropSlave::handleBulkMessage() {
+  if (!isAddressedToMe()) return;
+
+  // New transfer: size, chunk size, stream ID
+  if (command == CMD_BULK_START) {
+    if (dataIndex < 4) return;
+
+    bulkSize = (dataBuffer[0] << 8) | dataBuffer[1];
+    bulkChunkLen = dataBuffer[2];
+    bulkStream = dataBuffer[3];
+    bulkNextSeq = 0;
+
+    if (bulkChunkLen == 0 || bulkChunkLen > MD_BULK_CHUNK_LEN || !bulkSink) {
+      bulkState = BULK_ERROR;
+    } else {
+      bulkState = (bulkSize > 0) ? BULK_RECEIVING : BULK_DONE;
+    }
+  }
+
+  // Next chunk, only if it's the one we're waiting on
+  else if (command == CMD_BULK_DATA) {
+    uint16_t offset = bulkNextSeq * bulkChunkLen;
+    uint16_t remaining = bulkSize - offset;
+    uint8_t expectedLen = (remaining < bulkChunkLen) ? remaining : bulkChunkLen;
+
+    if (bulkState != BULK_RECEIVING || bulkSeq != bulkNextSeq || bulkIndex != expectedLen) {
+      return;
+    }
+
+    if (!bulkSink(bulkStream, offset, bulkBuffer, bulkIndex)) {
+      bulkState = BULK_ERROR;
+      return;
+    }
+
+    bulkNextSeq++;
+    if (offset + bulkIndex >= bulkSize) {
+      bulkState = BULK_DONE;
+    }
+  }
+}
+
+void MultidropSlave::switchBaud(uint8_t index) {
+  serial->begin(baudRate(index));
+  baudIndex = index;
+}
+
+void MultidropSlave::berStatusResponse(uint8_t *buff, uint8_t len) {
+  if (len >= MD_BER_STATUS_LEN) {
+    buff[0] = berFrames >> 8;
+    buff[1] = berFrames & 0xFF;
+    buff[2] = berBytes >> 24;
+    buff[3] = (berBytes >> 16) & 0xFF;
+    buff[4] = (berBytes >> 8) & 0xFF;
+    buff[5] = berBytes & 0xFF;
+    buff[6] = berByteErrors >> 8;
+    buff[7] = berByteErrors & 0xFF;
+    buff[8] = berBitErrors >> 8;
+    buff[9] = berBitErrors & 0xFF;
+  }
+}
+
+void MultidropSlave::capsResponse(uint8_t *buff, uint8_t len) {
+  if (len >= MD_CAPS_LEN) {
+    buff[0] = MD_PROTOCOL_VERSION;
+    buff[1] = MD_FEATURE_BULK | MD_FEATURE_RANGE | MD_FEATURE_CLASS | MD_FEATURE_EXTENDED;
+    buff[2] = baudMask;
+    buff[3] = appFeatures;
+    buff[4] = MD_MAX_DATA_LEN;
+    buff[5] = MD_BULK_CHUNK_LEN;
+    buff[6] = rxBufferLen;
+  }
+}
+
+void MultidropSlave::bulkStatusResponse(uint8_t *buff, uint8_t len) {
+  if (len >= 3) {
+    buff[0] = bulkNextSeq >> 8;
+    buff[1] = bulkNextSeq & 0xFF;
+    buff[2] = bulkState;
+  }
+}
+
+void MultidropSlave::receiveAddress(uint8_t b) {
+
+  // Extended addresses are 2 bytes, high byte first
+  if (isExtended()) {
+    if (!addrHalf) {
+      addrHi = b;
+      addrHalf = 1;
+      return;
+    }
+    addrHalf = 0;
+    processAddressing((addrHi << 8) | b);
+  }
+  else {
+    processAddressing(b);
+  }
+}
+
+void MultidropSlave::processAddressing(uint16_t b) {
+  uint16_t maxAddr = (isExtended()) ? 0xFFFF : 0xFF;
 
   // We still waiting for an address
   if (myAddress == 0 && isPrevDaisyEnabled() && !serial->available()){
@@ -268,8 +665,8 @@ void MultidropSlave::processAddressing(uint8_t b) {
         myAddress = b;
         setNextDaisyValue(1);
         
-        // Max address is 0xFF
-        if (b == 0xFF) {
+        // Max address is 0xFF (or 0xFFFF)
+        if (b == maxAddr) {
           doneAddressing();
         }
         return;
@@ -285,7 +682,7 @@ void MultidropSlave::processAddressing(uint8_t b) {
           setNextDaisyValue(1);
         }
         // Master ending message
-        else if (b == 0xFF) {
+        else if (b == maxAddr) {
           myAddress = 0;
           parsePos = ADDR_ERROR;
         }
@@ -302,15 +699,18 @@ void MultidropSlave::processAddressing(uint8_t b) {
       parsePos = ADDR_SENT;
       _delay_us(200);
       serial->enable_write();
-      serial->write(b);
+      if (isExtended()) {
+        serial->write(b >> 8);
+      }
+      serial->write(b & 0xFF);
       serial->enable_read();
       lastAddr = b;
       return;
     }
   }
 
-  // Done when we see two 0xFF
-  if (parsePos != ADDR_SENT && lastAddr == b && b == 0xFF) {
+  // Done when we see two 0xFF (or 0xFFFF)
+  if (parsePos != ADDR_SENT && lastAddr == b && b == maxAddr) {
     doneAddressing();
   }
 
@@ -323,26 +723,54 @@ void MultidropSlave::processAddressing(uint8_t b) {
 
 void MultidropSlave::doneAddressing() {
   dataIndex = 0;
-  dataBuffer[dataIndex++] = myAddress;
+  dataBuffer[dataIndex++] = myAddress & 0xFF;
+  if (isExtended()) {
+    dataBuffer[dataIndex++] = myAddress >> 8;
+  }
   dataBuffer[dataIndex] = '\0';
   parseState = MESSAGE_READY;
 }
 
 void MultidropSlave::sendResponse() {
-  if (responseHandler) {
-    uint8_t i;
-    responseHandler(command, dataBuffer, length);
+  uint8_t libraryResponse = (command == CMD_BULK_STATUS || command == CMD_GET_PROTOCOL ||
+                             command == CMD_GET_CAPS || command == CMD_BER_STATUS);
+
+  if (responseHandler || libraryResponse) {
+    uint8_t i, b;
+    uint8_t bufferLen = (length < MD_MAX_DATA_LEN) ? length : MD_MAX_DATA_LEN;
+
+    TRACE_BEGIN(RESPONSE);
+    if (command == CMD_BULK_STATUS) {
+      bulkStatusResponse(dataBuffer, bufferLen);
+    } else if (command == CMD_GET_PROTOCOL) {
+      dataBuffer[0] = MD_PROTOCOL_VERSION;
+    } else if (command == CMD_GET_CAPS) {
+      capsResponse(dataBuffer, bufferLen);
+    } else if (command == CMD_BER_STATUS) {
+      berStatusResponse(dataBuffer, bufferLen);
+    } else {
+      responseHandler(command, dataBuffer, bufferLen);
+    }
 
     // Make sure we're not butting up against other data that was just received
     _delay_us(150);
 
     // Write response buffer to stream
+    // (anything past the end of the buffer is padded with zeros)
     serial->enable_write();
     for (i = 0; i < length; i++) {
-      serial->write(dataBuffer[i]);
-      messageCRC = _crc16_update(messageCRC, dataBuffer[i]);
+      b = (i < bufferLen) ? dataBuffer[i] : 0;
+      serial->write(b);
+      messageCRC = _crc16_update(messageCRC, b);
       fullDataIndex++;
     }
     serial->enable_read();
+    TRACE_END(RESPONSE);
+
+    // We were the last node, the master's CRC is next
+    if (fullDataIndex >= fullDataLength) {
+      parsePos = DATA_POS;
+      parseState = END_SECTION;
+    }
   }
 }
@@ -8,10 +8,19 @@
 
 typedef void (*multidropResponseFunction)(uint8_t command, uint8_t *buff, uint8_t len);
 
+// Receives bulk transfer data, one verified chunk at a time, in order.
+// Return 1 if the chunk was accepted, or 0 to stop the transfer with an error.
+typedef uint8_t (*multidropBulkSink)(uint8_t stream, uint16_t offset, uint8_t *data, uint8_t len);
+
 #ifndef MD_MAX_DATA_LEN
 #define MD_MAX_DATA_LEN 10
 #endif
 
+// Largest bulk transfer chunk this node will accept
+#ifndef MD_BULK_CHUNK_LEN
+#define MD_BULK_CHUNK_LEN 64
+#endif
+
 /**
   Multidrop Slave class
 */
@@ -25,10 +34,10 @@ public:
 
   // Set our address on the network
   // Without setting this, the only messages we'll receive are broadcasts
-  void setAddress(uint8_t);
+  void setAddress(uint16_t);
 
   // Get our address on the network
-  uint8_t getAddress();
+  uint16_t getAddress();
 
   // Reads the latest data on the serial line
   // returns 1 if a new message is ready
@@ -56,14 +65,88 @@ public:
   // Is the current message in batch mode
   uint8_t inBatchMode();
 
+  // Does the current message use the extended header (16-bit addresses)
+  uint8_t isExtended();
+
   // Set to the function that will provide the proper
   // data for a response message. It is  best to keep
   // this function short and quick, because it will be
   // a blocking action.
   void setResponseHandler(multidropResponseFunction handler);
 
+  // Set the function that bulk transfer data is streamed into.
+  //
+  // A bulk transfer is larger than MD_MAX_DATA_LEN and is sent as a series of
+  // CMD_BULK_DATA chunks, each protected by its own message CRC. Chunks are
+  // passed to the sink in order; anything out of order is dropped and the
+  // master resends from the next chunk we're missing (see CMD_BULK_STATUS).
+  void setBulkSink(multidropBulkSink sink);
+
+  // Get the state of the current bulk transfer (BULK_*)
+  uint8_t getBulkState();
+
+  // Set this node's class and its index within the class, for class batch messages.
+  // This can also be set by the master with CMD_SET_CLASS.
+  void setNodeClass(uint8_t nodeClass, uint16_t index);
+
+  // Get this node's class (NO_CLASS if it has not been set)
+  uint8_t getNodeClass();
+
+  // Get this node's index within its class
+  uint16_t getClassIndex();
+
+  // Set the values this node reports with CMD_GET_CAPS:
+  //   * appFeatures: Application specific feature flags
+  //   * rxBufferLen: Size of the serial receive buffer
+  void setCapabilities(uint8_t appFeatures, uint8_t rxBufferLen);
+
+  // Set which baud rates this node can switch to (1 << MD_BAUD_*).
+  // This defaults to every rate the UART can reach within 2% at F_CPU.
+  void setBaudMask(uint8_t mask);
+
+  // Get the baud rates this node can switch to
+  uint8_t getBaudMask();
+
+  // Number of messages that failed their CRC check
+  uint16_t getCrcErrors();
+
+  // Number of valid messages received
+  uint16_t getMessageCount();
+
+  // Reset the CRC error and message counts
+  void resetCounters();
+
+  // Bit error rate test counts (see CMD_BER_START)
+  uint16_t getBerFrames();
+  uint32_t getBerBytes();
+  uint16_t getBerByteErrors();
+  uint16_t getBerBitErrors();
+
 private:
   multidropResponseFunction responseHandler;
+  multidropBulkSink bulkSink;
+
+  // Health counters
+  uint16_t crcErrors,
+           messageCount;
+
+  // Bit error rate test values
+  uint16_t berSeed,
+           berState,     // Pattern generator for the current frame
+           berFrames,
+           berByteErrors,
+           berBitErrors;
+  uint32_t berBytes,
+           berRemaining; // Bytes left until the test is over
+  uint8_t  berReturnBaud; // Rate to go back to after the test
+
+  // Baud rate index we're at (MD_BAUD_*)
+  uint8_t baudIndex;
+
+  // Capability values
+  uint8_t appFeatures,
+          baudMask,
+          rxBufferLen;
 
   enum msg_state_t {
     NO_MESSAGE,
@@ -78,10 +161,15 @@ private:
     SOM1_POS,        // Start of message (first byte)
     SOM2_POS,        // Start of message (second byte)
     HEADER_FLAGS_POS,
+    HEADER_ADDR_HI_POS,     // Extended header: address high byte
     HEADER_ADDR_POS,
     HEADER_CMD_POS,
+    HEADER_LEN1_HI_POS,     // Extended header: number of nodes high byte
     HEADER_LEN1_POS,
     HEADER_LEN2_POS,
+    HEADER_CLASS_COUNT_POS, // Class table: node count
+    HEADER_CLASS_COUNT_LO_POS, // Class table: node count low byte (extended headers)
+    HEADER_CLASS_LEN_POS,   // Class table: slot length
     DATA_POS,
     EOM1_POS,
     EOM2_POS,
@@ -96,22 +184,42 @@ private:
   enum ms_position_t parsePos;
 
   uint8_t flags,
-          address,
           command,
           length,
-          numNodes,
-          myAddress,
           dataIndex,
-          lastAddr,
-          errCount;
+          errCount,
+          addrHi,       // First byte of an extended address, during addressing
+          addrHalf,     // addrHi has been received
+          inRange,      // This node has a slot in the batch message
+          nodeClass,
+          classNum;     // Class table entry being parsed
+
+  // Addresses and node counts are 16-bit, for extended headers
+  uint16_t address,
+           numNodes,
+           myAddress,
+           lastAddr,
+           firstAddress, // First node in the batch range
+           classIndex,
+           classNodes;   // Node count of the class table entry being parsed
 
   // Batch mode values
-  uint16_t fullDataLength,  // Length of the entire data section for all nodes
+  uint32_t fullDataLength,  // Length of the entire data section for all nodes
            fullDataIndex,   // The actual index of the entire data section
            dataStartOffset; // Where this node's data starts.
 
   uint8_t dataBuffer[MD_MAX_DATA_LEN + 1];
 
+  // Bulk transfer values
+  uint8_t  bulkState,
+           bulkStream,
+           bulkChunkLen,  // Size of every chunk, except the last one
+           bulkIndex;     // Bytes received in the current chunk
+  uint16_t bulkSize,      // Size of the whole transfer
+           bulkNextSeq,   // Next chunk we need
+           bulkSeq;       // Sequence number of the chunk being received
+  uint8_t  bulkBuffer[MD_BULK_CHUNK_LEN];
+
   // Start a new message by resetting all values
   void startMessage();
 
@@ -124,14 +232,44 @@ private:
   // Process the data section of the message
   void processData(uint8_t);
 
+  // Receive the next byte of the addressing message
+  void receiveAddress(uint8_t);
+
   // Process the addressing response part of the addressing message
-  void processAddressing(uint8_t);
+  void processAddressing(uint16_t);
 
   // Finish the addressing message
   void doneAddressing();
 
   // Send a response to a message
   void sendResponse();
+
+  // The batch header node count has been received
+  void startBatchHeader();
+
+  // Parse the next byte of a class batch message's class table
+  void parseClassTable(uint8_t);
+
+  // Handle a bulk transfer message that has been fully received
+  void handleBulkMessage();
+
+  // Receive the next byte of a bulk data chunk
+  void processBulkData(uint8_t);
+
+  // Check the next byte of a bit error rate test pattern
+  void processBerData(uint8_t);
+
+  // Fill the response buffer with the bit error rate test counts
+  void berStatusResponse(uint8_t *buff, uint8_t len);
+
+  // Switch the serial port to another baud rate (MD_BAUD_*)
+  void switchBaud(uint8_t index);
+
+  // Fill the response buffer with our capabilities
+  void capsResponse(uint8_t *buff, uint8_t len);
+
+  // Fill the response buffer with the bulk transfer status
+  void bulkStatusResponse(uint8_t *buff, uint8_t len);
 };
 
 #endif
@@ -0,0 +1,20 @@
+/**
+ * Trace hooks for the bus library.
+ *
+ * When built with TRACE defined, the library times its receive interrupt,
+ * parsing and responses with the TRACE_BEGIN/TRACE_END macros from the
+ * application's trace.h. Otherwise the hooks compile to nothing.
+ */
+
+#ifndef MULTIDROP_TRACE_H
+#define MULTIDROP_TRACE_H
+
+#ifdef TRACE
+#include "trace.h"
+#else
+#define TRACE_BEGIN(ev)
+#define TRACE_END(ev)
+#define TRACE_MARK(ev)
+#endif
+
+#endif
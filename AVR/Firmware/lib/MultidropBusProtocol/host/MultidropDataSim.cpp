@@ -0,0 +1,268 @@
+/*******************************************************************************
+* Simulated bus
+*
+* The bus keeps a log of every byte sent, with the time it finishes. Each port
+* reads the log from its own cursor, skipping its own bytes (like the
+* transceivers, whose receiver is off while they drive the bus). Bytes every
+* port has read are dropped.
+******************************************************************************/
+
+#include <stddef.h>
+#include <util/delay.h>
+#include "MultidropDataSim.h"
+
+// Bits per byte on the wire: start, 8 data, stop
+#define BITS_PER_BYTE 10
+
+// Bytes kept in the log before trying to drop the ones that have been read
+#define LOG_TRIM_SIZE 4096
+
+// Bus that _delay_us() calls are for
+static MultidropSimBus *delayBus = 0;
+
+MultidropSimBus::MultidropSimBus() {
+  bytesSent = 0;
+  bitErrors = 0;
+  collisions = 0;
+  logStart = 0;
+  time = 0;
+  cpuTime = 0;
+  lastEnd = 0;
+  lastSender = 0xFFFF;
+  turnaround = 1000;
+  bitErrorRate = 0;
+  setSeed(1);
+
+  delayBus = this;
+  md_host_delay = &MultidropSimBus::delay;
+}
+
+void MultidropSimBus::setTurnaround(uint32_t ns) {
+  turnaround = ns;
+}
+
+void MultidropSimBus::setBitErrorRate(double rate) {
+  bitErrorRate = rate;
+}
+
+void MultidropSimBus::setSeed(uint32_t seed) {
+  // Spread out small seeds, xorshift takes a while to get going from them
+  rand = seed * 2654435761u;
+  if (!rand) rand = 1;
+  for (uint8_t i = 0; i < 16; i++) {
+    nextRandom();
+  }
+}
+
+uint64_t MultidropSimBus::now() {
+  return time;
+}
+
+uint32_t MultidropSimBus::micros() {
+  return time / 1000;
+}
+
+uint64_t MultidropSimBus::idleAt() {
+  return (lastEnd > time) ? lastEnd : time;
+}
+
+void MultidropSimBus::advance(uint64_t ns) {
+  time += ns;
+  if (cpuTime < time) {
+    cpuTime = time;
+  }
+  if (log.size() > LOG_TRIM_SIZE) {
+    trim();
+  }
+}
+
+void MultidropSimBus::advanceToNextByte(uint64_t maxNs) {
+  uint64_t next = time + maxNs;
+
+  // Bytes finish in about the order they were sent, so the first
+  // one that hasn't finished yet is the next
+  for (size_t i = log.size(); i > 0; i--) {
+    uint64_t end = log[i - 1].end;
+    if (end <= time) break;
+    if (end < next) {
+      next = end;
+    }
+  }
+  advance(next - time);
+}
+
+void MultidropSimBus::resume() {
+  cpuTime = time;
+}
+
+void MultidropSimBus::connectDaisy(MultidropDataSim *a, uint8_t lineA, MultidropDataSim *b, uint8_t lineB) {
+  Wire wire = { a, b, (uint8_t)(lineA - 1), (uint8_t)(lineB - 1) };
+  wires.push_back(wire);
+  syncDaisy(a);
+}
+
+void MultidropSimBus::chainDaisy() {
+  for (size_t i = 1; i < ports.size(); i++) {
+    connectDaisy(ports[i - 1], (i == 1) ? 1 : 2, ports[i], 1);
+  }
+}
+
+void MultidropSimBus::syncDaisy(MultidropDataSim *port) {
+  for (size_t i = 0; i < wires.size(); i++) {
+    Wire &w = wires[i];
+    if (w.a != port && w.b != port) continue;
+
+    // Inputs are pulled up, outputs pull the line to their level
+    uint8_t a = (w.a->daisyDdr[w.lineA] & 1) ? (w.a->daisyPort[w.lineA] & 1) : 1;
+    uint8_t b = (w.b->daisyDdr[w.lineB] & 1) ? (w.b->daisyPort[w.lineB] & 1) : 1;
+    uint8_t level = a & b;
+
+    w.a->daisyPin[w.lineA] = level;
+    w.b->daisyPin[w.lineB] = level;
+  }
+}
+
+uint16_t MultidropSimBus::attach(MultidropDataSim *port) {
+  ports.push_back(port);
+  return ports.size() - 1;
+}
+
+void MultidropSimBus::send(MultidropDataSim *port, uint8_t b) {
+  uint64_t start = (cpuTime > port->txFreeAt) ? cpuTime : port->txFreeAt;
+  Byte byte;
+
+  byte.end = start + (BITS_PER_BYTE * 1000000000ULL) / port->baud;
+  byte.baud = port->baud;
+  byte.sender = port->id;
+  byte.value = b;
+
+  // Noise
+  if (bitErrorRate > 0) {
+    for (uint8_t i = 0; i < 8; i++) {
+      if (nextRandom() < bitErrorRate * 0xFFFFFFFFu) {
+        byte.value ^= (1 << i);
+        bitErrors++;
+      }
+    }
+  }
+
+  // Another port is still sending, both bytes are garbage
+  if (start < lastEnd && lastSender != port->id) {
+    collisions++;
+    byte.value ^= nextRandom() | 1;
+    if (!log.empty()) {
+      log.back().value ^= nextRandom() | 1;
+    }
+  }
+
+  log.push_back(byte);
+  port->txFreeAt = byte.end;
+  if (byte.end > lastEnd) {
+    lastEnd = byte.end;
+  }
+  lastSender = port->id;
+  bytesSent++;
+}
+
+void MultidropSimBus::trim() {
+  uint64_t first = logStart + log.size();
+  for (size_t i = 0; i < ports.size(); i++) {
+    if (ports[i]->cursor < first) {
+      first = ports[i]->cursor;
+    }
+  }
+  while (logStart < first) {
+    log.pop_front();
+    logStart++;
+  }
+}
+
+uint32_t MultidropSimBus::nextRandom() {
+  rand ^= rand << 13;
+  rand ^= rand >> 17;
+  rand ^= rand << 5;
+  return rand;
+}
+
+void MultidropSimBus::delay(double us) {
+  if (delayBus) {
+    delayBus->cpuTime += (uint64_t)(us * 1000);
+  }
+}
+
+MultidropDataSim::MultidropDataSim(MultidropSimBus *_bus) : bus(_bus) {
+  id = bus->attach(this);
+  baud = 250000;
+  cursor = bus->logStart + bus->log.size();
+  txFreeAt = 0;
+
+  for (uint8_t i = 0; i < 2; i++) {
+    daisyDdr[i] = 0;
+    daisyPort[i] = 0;
+    daisyPin[i] = 1;
+  }
+}
+
+void MultidropDataSim::begin(uint32_t rate) {
+  baud = rate;
+}
+
+uint8_t MultidropDataSim::available() {
+  uint64_t end = bus->logStart + bus->log.size();
+  uint8_t count = 0;
+
+  for (uint64_t i = cursor; i < end && count < 0xFF; i++) {
+    MultidropSimBus::Byte &b = bus->log[i - bus->logStart];
+    if (b.end > bus->time) break;
+    if (b.sender != id) {
+      count++;
+    }
+  }
+  return count;
+}
+
+uint8_t MultidropDataSim::read() {
+  uint64_t end = bus->logStart + bus->log.size();
+
+  while (cursor < end) {
+    MultidropSimBus::Byte &b = bus->log[cursor - bus->logStart];
+    if (b.end > bus->time) break;
+    cursor++;
+
+    if (b.sender == id) continue;
+
+    // Sent at a different baud rate
+    if (b.baud != baud) {
+      return b.value ^ 0xA5;
+    }
+    return b.value;
+  }
+  return -1;
+}
+
+void MultidropDataSim::write(uint8_t b) {
+  bus->send(this, b);
+}
+
+void MultidropDataSim::flush() {
+  if (bus->cpuTime < txFreeAt) {
+    bus->cpuTime = txFreeAt;
+  }
+}
+
+void MultidropDataSim::clear() {
+  while (available()) {
+    read();
+  }
+}
+
+void MultidropDataSim::enable_write() {
+  uint64_t ready = bus->cpuTime + bus->turnaround;
+  if (txFreeAt < ready) {
+    txFreeAt = ready;
+  }
+}
+
+void MultidropDataSim::enable_read() {
+  flush();
+}
@@ -0,0 +1,150 @@
+/**
+ * Simulated multidrop bus, for running the bus library on a host.
+ *
+ * Every node (master or slave) gets a MultidropDataSim port on the same
+ * MultidropSimBus. Bytes written to a port take 10 bit times at that port's
+ * baud rate and reach every other port when they finish. The bus also models:
+ *
+ *   * Turnaround: the driver enable time before the first byte after enable_write().
+ *   * Delays: _delay_us() in the node's code pushes back what it sends next.
+ *   * Collisions: two ports sending at once garble both bytes.
+ *   * Noise: each data bit can be flipped, at a set bit error rate.
+ *   * Baud rates: bytes sent at another rate than the receiver's are garbage.
+ *   * Daisy chain lines: each port has two lines, which can be wired to
+ *     a line of another port, with pull-ups.
+ *
+ * The simulation is single threaded and nodes run in no time. Call resume()
+ * before running a node's code, and syncDaisy() after it, then advance() the
+ * bus time to deliver the next bytes.
+ */
+
+#ifndef MultidropDataSim_H
+#define MultidropDataSim_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "MultidropData.h"
+
+class MultidropDataSim;
+
+class MultidropSimBus {
+public:
+  MultidropSimBus();
+
+  // Driver enable time, in nanoseconds (default: 1us)
+  void setTurnaround(uint32_t ns);
+
+  // Chance of each data bit being flipped (default: 0)
+  void setBitErrorRate(double rate);
+
+  // Seed for the noise and collision garbage
+  void setSeed(uint32_t seed);
+
+  // Current bus time
+  uint64_t now();
+  uint32_t micros();
+
+  // When the last byte that was sent finishes
+  uint64_t idleAt();
+
+  // Move the bus time forward
+  void advance(uint64_t ns);
+
+  // Move the bus time to when the next byte finishes, but by at most `maxNs`
+  void advanceToNextByte(uint64_t maxNs);
+
+  // A node's code is about to run, starting at the current bus time
+  void resume();
+
+  // Wire daisy chain line `lineA` (1 or 2) of one port to line `lineB` of another
+  void connectDaisy(MultidropDataSim *a, uint8_t lineA, MultidropDataSim *b, uint8_t lineB);
+
+  // Wire every port to the next, in the order they were created: the master's
+  // line 1 to the first slave's line 1, then line 2 of each slave to line 1 of the next
+  void chainDaisy();
+
+  // Update the daisy chain lines wired to a port, after its node has run
+  void syncDaisy(MultidropDataSim *port);
+
+  // Counts since the bus was created
+  uint32_t bytesSent,
+           bitErrors,
+           collisions;
+
+private:
+  friend class MultidropDataSim;
+
+  struct Byte {
+    uint64_t end;
+    uint32_t baud;
+    uint16_t sender;
+    uint8_t value;
+  };
+
+  struct Wire {
+    MultidropDataSim *a, *b;
+    uint8_t lineA, lineB;
+  };
+
+  std::vector<MultidropDataSim*> ports;
+  std::vector<Wire> wires;
+
+  // Bytes on the bus, oldest first. logStart is the index of the first one.
+  std::deque<Byte> log;
+  uint64_t logStart;
+
+  uint64_t time,
+           cpuTime,     // Time in the node's code that is running
+           lastEnd,
+           turnaround;
+  uint16_t lastSender;
+
+  double bitErrorRate;
+  uint32_t rand;
+
+  // Add a port and get its ID
+  uint16_t attach(MultidropDataSim *port);
+
+  // Put a byte on the bus
+  void send(MultidropDataSim *port, uint8_t b);
+
+  // Drop bytes every port has read
+  void trim();
+
+  uint32_t nextRandom();
+
+  // A node called _delay_us()
+  static void delay(double us);
+};
+
+class MultidropDataSim : public MultidropData {
+public:
+  MultidropDataSim(MultidropSimBus *bus);
+
+  void begin(uint32_t baud);
+  uint8_t available();
+  uint8_t read();
+  void write(uint8_t b);
+  void flush();
+  void clear();
+  void enable_write();
+  void enable_read();
+
+  // Daisy chain lines 1 and 2 (bit 0 of each register).
+  // Pass these to addDaisyChain() or addNextDaisyChain().
+  volatile uint8_t daisyDdr[2],
+                   daisyPort[2],
+                   daisyPin[2];
+
+private:
+  friend class MultidropSimBus;
+
+  MultidropSimBus *bus;
+  uint16_t id;
+  uint32_t baud;
+  uint64_t cursor,     // Next byte to read from the bus log
+           txFreeAt;   // When this port's transmitter is free
+};
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * Host stand-in for <avr/interrupt.h>.
+ *
+ * ISR(vector) defines a plain function, so host code can "fire" an interrupt
+ * by calling it, for example USART_RX_vect() after setting UDR0.
+ */
+
+#ifndef MD_HOST_AVR_INTERRUPT_H
+#define MD_HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void); extern "C" void vector(void)
+
+#define sei()
+#define cli()
+
+#endif
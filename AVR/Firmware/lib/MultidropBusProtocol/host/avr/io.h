@@ -0,0 +1,86 @@
+/**
+ * Host stand-in for <avr/io.h>.
+ *
+ * Only the host build (see host/Makefile) puts this directory on the include
+ * path. The I/O registers the bus library uses are plain variables (see
+ * host_avr.cpp), and the UART is always ready to transmit, so
+ * MultidropDataUart works without a real USART behind it.
+ */
+
+#ifndef MD_HOST_AVR_IO_H
+#define MD_HOST_AVR_IO_H
+
+#include <stdint.h>
+
+// USART0 status register: reads always have UDRE0 and TXC0 set
+class MdHostStatusReg {
+public:
+  uint8_t value;
+
+  operator uint8_t() const;
+  MdHostStatusReg& operator=(uint8_t v) { value = v; return *this; }
+  MdHostStatusReg& operator|=(uint8_t v) { value |= v; return *this; }
+  MdHostStatusReg& operator&=(uint8_t v) { value &= v; return *this; }
+};
+
+extern MdHostStatusReg UCSR0A;
+extern volatile uint8_t UCSR0B, UCSR0C, UDR0, UBRR0H, UBRR0L;
+
+// I/O space, for pin descriptors (see MultidropPins.h)
+extern volatile uint8_t md_host_io[64];
+#define _SFR_IO8(addr) (md_host_io[addr])
+
+#define DDRB  _SFR_IO8(0x04)
+#define PORTB _SFR_IO8(0x05)
+#define PINB  _SFR_IO8(0x03)
+#define DDRC  _SFR_IO8(0x07)
+#define PORTC _SFR_IO8(0x08)
+#define PINC  _SFR_IO8(0x06)
+#define DDRD  _SFR_IO8(0x0A)
+#define PORTD _SFR_IO8(0x0B)
+#define PIND  _SFR_IO8(0x09)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// UCSR0A
+#define RXC0  7
+#define TXC0  6
+#define UDRE0 5
+#define FE0   4
+#define DOR0  3
+#define UPE0  2
+#define U2X0  1
+
+// UCSR0B
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+
+// UCSR0C
+#define UCSZ01 2
+#define UCSZ00 1
+
+#define _BV(b) (1 << (b))
+
+#endif
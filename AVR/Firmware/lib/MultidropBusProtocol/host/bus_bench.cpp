@@ -0,0 +1,384 @@
+/*******************************************************************************
+* Bus library benchmarks
+*
+* Times the hot paths of the bus library on the host: slave parsing (through
+* MultidropSlave::read()), master frame building, CRC-16 variants and the UART
+* ring buffer. Each benchmark is run several times and the fastest run is
+* reported, as CSV on stdout:
+*
+*   benchmark,ns_per_byte,ns_per_op,bytes_per_op
+*
+* These are host numbers. They're for comparing versions of the library with
+* each other, on the same machine, not for AVR cycle counts.
+*
+*   ./bus_bench [-r runs] [-m min ms per run]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include <util/crc16.h>
+#include "MultidropMaster.h"
+#include "MultidropSlave.h"
+#include "MultidropDataUart.h"
+
+extern "C" void USART_RX_vect(void);
+
+// Command for the benchmark frames
+#define CMD_BENCH 0x01
+
+// Keeps results from being optimized away
+static volatile uint32_t sink;
+
+/*----------------------------------------------------------------------------
+                              data links
+----------------------------------------------------------------------------*/
+
+// Reads from a buffer
+class BufferData : public MultidropData {
+public:
+  const uint8_t *data;
+  uint32_t len, pos;
+
+  BufferData() : data(0), len(0), pos(0) { }
+  void reset(const uint8_t *d, uint32_t l) { data = d; len = l; pos = 0; }
+
+  void begin(uint32_t) { }
+  uint8_t available() { uint32_t n = len - pos; return (n > 0xFF) ? 0xFF : n; }
+  uint8_t read() { return (pos < len) ? data[pos++] : 0xFF; }
+  void write(uint8_t b) { sink += b; }
+  void flush() { }
+  void clear() { pos = len; }
+  void enable_write() { }
+  void enable_read() { }
+};
+
+// Counts what's written
+class CountData : public BufferData {
+public:
+  uint32_t written;
+
+  CountData() : written(0) { }
+  void write(uint8_t b) { written++; sink += b; }
+};
+
+/*----------------------------------------------------------------------------
+                              CRC variants
+----------------------------------------------------------------------------*/
+
+// All of these match _crc16_update() (polynomial 0xA001, reflected)
+
+// Bit at a time, like _crc16_update() (see util/crc16.h)
+static uint16_t crc16_bitwise(uint16_t crc, uint8_t a) {
+  return _crc16_update(crc, a);
+}
+
+// 256 entry table (512 bytes)
+static uint16_t crcTable[256];
+
+static void crc16_table_init() {
+  for (uint16_t i = 0; i < 256; i++) {
+    crcTable[i] = _crc16_update(0, i);
+  }
+}
+
+static uint16_t crc16_table(uint16_t crc, uint8_t a) {
+  return (crc >> 8) ^ crcTable[(crc ^ a) & 0xFF];
+}
+
+// 16 entry table, a nibble at a time (32 bytes)
+static uint16_t crcNibble[16];
+
+static void crc16_nibble_init() {
+  for (uint8_t i = 0; i < 16; i++) {
+    uint16_t crc = i;
+    for (uint8_t b = 0; b < 4; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+    crcNibble[i] = crc;
+  }
+}
+
+static uint16_t crc16_nibble(uint16_t crc, uint8_t a) {
+  crc ^= a;
+  crc = (crc >> 4) ^ crcNibble[crc & 0x0F];
+  crc = (crc >> 4) ^ crcNibble[crc & 0x0F];
+  return crc;
+}
+
+// No table, using the parity of the low byte (Maxim app note 27)
+static uint16_t crc16_parity(uint16_t crc, uint8_t a) {
+  static const uint8_t oddParity[16] = { 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 };
+  uint16_t x = (crc ^ a) & 0xFF;
+
+  crc >>= 8;
+  if (oddParity[x & 0x0F] ^ oddParity[x >> 4]) {
+    crc ^= 0xC001;
+  }
+  x <<= 6;
+  crc ^= x;
+  x <<= 1;
+  crc ^= x;
+  return crc;
+}
+
+typedef uint16_t (*crcFunction)(uint16_t crc, uint8_t a);
+
+/*----------------------------------------------------------------------------
+                              timing
+----------------------------------------------------------------------------*/
+
+static int runs = 5;
+static double minRunNs = 50e6;
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Each benchmark does one operation per call and returns the bytes it handled
+typedef uint32_t (*benchFunction)();
+
+static void bench(const char *name, benchFunction fn) {
+  double best = 0;
+  uint32_t bytes = 0;
+
+  for (int r = 0; r < runs; r++) {
+    uint32_t ops = 0;
+    double start = nowNs(), elapsed;
+
+    do {
+      for (uint8_t i = 0; i < 16; i++) {
+        bytes = fn();
+      }
+      ops += 16;
+      elapsed = nowNs() - start;
+    } while (elapsed < minRunNs);
+
+    double perOp = elapsed / ops;
+    if (r == 0 || perOp < best) {
+      best = perOp;
+    }
+  }
+
+  printf("%s,%.3f,%.1f,%u\n", name, best / bytes, best, bytes);
+}
+
+/*----------------------------------------------------------------------------
+                              benchmarks
+----------------------------------------------------------------------------*/
+
+#define NODES 255
+#define NODE_LEN 3
+
+static BufferData slaveData;
+static MultidropSlave slave(&slaveData);
+
+// Daisy chain registers for the slave (lines 1 and 2, pulled up)
+static volatile uint8_t daisyDdr, daisyPort, daisyPin = 0xFF;
+
+static CountData masterData;
+static MultidropMaster master(&masterData);
+
+static std::vector<uint8_t> batchFrame, unicastFrame, otherFrame;
+static uint8_t frameData[NODES * NODE_LEN];
+static uint8_t crcData[1024];
+
+// Build a frame with the master, as the slaves would receive it
+static std::vector<uint8_t> buildFrame(uint16_t dest, uint8_t batch) {
+  std::vector<uint8_t> frame;
+  class Capture : public BufferData {
+  public:
+    std::vector<uint8_t> *out;
+    void write(uint8_t b) { out->push_back(b); }
+  } capture;
+  capture.out = &frame;
+
+  MultidropMaster m(&capture);
+  m.setNodeLength(NODES);
+  m.startMessage(CMD_BENCH, dest, NODE_LEN, batch);
+  m.sendData(frameData, batch ? NODES * NODE_LEN : NODE_LEN);
+  m.finishMessage();
+  return frame;
+}
+
+static uint32_t parseFrame(std::vector<uint8_t> &frame) {
+  slaveData.reset(&frame[0], frame.size());
+  while (slaveData.pos < slaveData.len) {
+    if (slave.read()) {
+      sink += slave.getDataLen();
+    }
+  }
+  return frame.size();
+}
+
+// A batch frame for every node, parsed by a node in the middle of the floor
+static uint32_t benchParseBatch() {
+  return parseFrame(batchFrame);
+}
+
+// A frame for this node
+static uint32_t benchParseUnicast() {
+  return parseFrame(unicastFrame);
+}
+
+// A frame for another node
+static uint32_t benchParseOther() {
+  return parseFrame(otherFrame);
+}
+
+// A batch frame for every node
+static uint32_t benchMasterBatch() {
+  masterData.written = 0;
+  master.startMessage(CMD_BENCH, Multidrop::BROADCAST_ADDRESS, NODE_LEN, true);
+  master.sendData(frameData, sizeof(frameData));
+  master.finishMessage();
+  return masterData.written;
+}
+
+// The same, a byte at a time
+static uint32_t benchMasterBatchBytes() {
+  masterData.written = 0;
+  master.startMessage(CMD_BENCH, Multidrop::BROADCAST_ADDRESS, NODE_LEN, true);
+  for (uint16_t i = 0; i < sizeof(frameData); i++) {
+    master.sendData(frameData[i]);
+  }
+  master.finishMessage();
+  return masterData.written;
+}
+
+static uint32_t benchMasterUnicast() {
+  masterData.written = 0;
+  master.startMessage(CMD_BENCH, 1, NODE_LEN);
+  master.sendData(frameData, NODE_LEN);
+  master.finishMessage();
+  return masterData.written;
+}
+
+static uint32_t crcRun(crcFunction fn) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < sizeof(crcData); i++) {
+    crc = fn(crc, crcData[i]);
+  }
+  sink += crc;
+  return sizeof(crcData);
+}
+
+static uint32_t benchCrcBitwise() { return crcRun(crc16_bitwise); }
+static uint32_t benchCrcTable() { return crcRun(crc16_table); }
+static uint32_t benchCrcNibble() { return crcRun(crc16_nibble); }
+static uint32_t benchCrcParity() { return crcRun(crc16_parity); }
+
+static MultidropDataUart uart;
+
+// Bytes through the RX interrupt, then read out of the ring buffer
+#define UART_BYTES 100
+
+static uint32_t benchUartRx() {
+  for (uint8_t i = 0; i < UART_BYTES; i++) {
+    UDR0 = i;
+    USART_RX_vect();
+  }
+  while (uart.available()) {
+    sink += uart.read();
+  }
+  return UART_BYTES;
+}
+
+// Only the RX interrupt (the buffer is emptied without timing the reads)
+static uint32_t benchUartRxIsr() {
+  uart.clear();
+  for (uint8_t i = 0; i < UART_BYTES; i++) {
+    UDR0 = i;
+    USART_RX_vect();
+  }
+  return UART_BYTES;
+}
+
+// Writes (the host UART is always ready, so these skip the TX buffer)
+static uint32_t benchUartTx() {
+  for (uint8_t i = 0; i < UART_BYTES; i++) {
+    uart.write(i);
+  }
+  uart.flush();
+  return UART_BYTES;
+}
+
+/*----------------------------------------------------------------------------
+                              program
+----------------------------------------------------------------------------*/
+
+int main(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-r")) runs = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-m")) minRunNs = atof(argv[i + 1]) * 1e6;
+    else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (runs < 1) runs = 1;
+
+  for (uint16_t i = 0; i < sizeof(frameData); i++) {
+    frameData[i] = i * 7;
+  }
+  for (uint16_t i = 0; i < sizeof(crcData); i++) {
+    crcData[i] = i * 13 + (i >> 8);
+  }
+
+  // Every variant needs to match _crc16_update()
+  crc16_table_init();
+  crc16_nibble_init();
+  crcFunction variants[] = { crc16_table, crc16_nibble, crc16_parity };
+  for (uint8_t v = 0; v < 3; v++) {
+    uint16_t expect = 0xFFFF, crc = 0xFFFF;
+    for (uint16_t i = 0; i < sizeof(crcData); i++) {
+      expect = _crc16_update(expect, crcData[i]);
+      crc = variants[v](crc, crcData[i]);
+    }
+    if (crc != expect) {
+      fprintf(stderr, "CRC variant %u doesn't match _crc16_update()\n", v);
+      return 1;
+    }
+  }
+
+  slave.addDaisyChain(0, &daisyDdr, &daisyPort, &daisyPin,
+                      1, &daisyDdr, &daisyPort, &daisyPin);
+  slave.setAddress(NODES / 2);
+  master.setNodeLength(NODES);
+  batchFrame = buildFrame(Multidrop::BROADCAST_ADDRESS, true);
+  unicastFrame = buildFrame(NODES / 2, false);
+  otherFrame = buildFrame(NODES / 2 + 1, false);
+
+  // The frames need to parse before they're worth timing
+  if (!parseFrame(batchFrame) || slave.getDataLen() != NODE_LEN || slave.getCrcErrors()) {
+    fprintf(stderr, "Benchmark frames don't parse\n");
+    return 1;
+  }
+  uart.begin(250000);
+
+  printf("benchmark,ns_per_byte,ns_per_op,bytes_per_op\n");
+  bench("parse_batch", benchParseBatch);
+  bench("parse_unicast", benchParseUnicast);
+  bench("parse_unicast_other", benchParseOther);
+  bench("master_batch", benchMasterBatch);
+  bench("master_batch_bytewise", benchMasterBatchBytes);
+  bench("master_unicast", benchMasterUnicast);
+  bench("crc16_bitwise", benchCrcBitwise);
+  bench("crc16_table", benchCrcTable);
+  bench("crc16_nibble", benchCrcNibble);
+  bench("crc16_parity", benchCrcParity);
+  bench("uart_rx", benchUartRx);
+  bench("uart_rx_isr", benchUartRxIsr);
+  bench("uart_tx", benchUartTx);
+
+  if (slave.getCrcErrors()) {
+    fprintf(stderr, "CRC errors while parsing\n");
+    return 1;
+  }
+  return 0;
+}
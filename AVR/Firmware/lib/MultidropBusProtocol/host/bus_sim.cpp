@@ -0,0 +1,243 @@
+/*******************************************************************************
+* Bus simulation
+*
+* Runs one master and a floor of slaves on the simulated bus: addresses the
+* nodes, switches baud rate (and checks every node made it), sends batch frames to every node and collects a
+* batch response. Reports how long each step takes on the bus, and the
+* frames per second the floor could be updated at.
+*
+*   ./bus_sim [-n nodes] [-b baud index] [-l bytes per node] [-f frames]
+*             [-t turnaround us] [-e bit error rate] [-s seed]
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "MultidropMaster.h"
+#include "MultidropSlave.h"
+#include "MultidropDataSim.h"
+
+// Command for the simulated frames
+#define CMD_SIM_FRAME 0x01
+
+// Longest step between bus events, in ns
+#define IDLE_STEP 10000
+
+// How long master waits for each node, in us
+#define ADDR_TIMEOUT_US 2000
+#define RESPONSE_TIMEOUT_US 2000
+
+static MultidropSimBus bus;
+static MultidropDataSim masterPort(&bus);
+static MultidropMaster master(&masterPort);
+
+static std::vector<MultidropDataSim*> ports;
+static std::vector<MultidropSlave*> slaves;
+
+// Frames each node received with the right data
+static std::vector<uint32_t> framesOk;
+
+static uint16_t frameNum;
+static uint8_t frameLen = 3;
+
+// Frame data byte `i` for the node at `addr`
+static uint8_t frameByte(uint16_t addr, uint16_t frame, uint8_t i) {
+  return (uint8_t)(addr * 7 + frame * 13 + i);
+}
+
+// Let every slave handle what has arrived
+static void runSlaves() {
+  for (size_t i = 0; i < slaves.size(); i++) {
+    MultidropSlave *s = slaves[i];
+
+    bus.resume();
+    while (s->read()) {
+      if (s->getCommand() != CMD_SIM_FRAME || !s->isAddressedToMe()) continue;
+
+      uint8_t *data = s->getData();
+      uint8_t ok = (s->getDataLen() == frameLen);
+      for (uint8_t b = 0; ok && b < frameLen; b++) {
+        ok = (data[b] == frameByte(s->getAddress(), frameNum, b));
+      }
+      if (ok) {
+        framesOk[i]++;
+      }
+    }
+    bus.syncDaisy(ports[i]);
+  }
+}
+
+// Run the slaves until everything on the bus has been received
+static void drain() {
+  while (bus.now() < bus.idleAt()) {
+    bus.advanceToNextByte(IDLE_STEP);
+    runSlaves();
+  }
+  runSlaves();
+}
+
+// Batch response message with 1 byte from each node
+static uint8_t collectResponses(uint8_t command, uint8_t *responses, uint8_t *defaultResponse) {
+  bus.resume();
+  if (!master.startMessage(command, Multidrop::BROADCAST_ADDRESS, 1, true, true)) {
+    return 0;
+  }
+  master.setResponseSettings(responses, bus.micros(), RESPONSE_TIMEOUT_US, defaultResponse);
+  do {
+    bus.advanceToNextByte(IDLE_STEP);
+    runSlaves();
+    bus.resume();
+  } while (!master.checkForResponses(bus.micros()));
+  drain();
+  return 1;
+}
+
+static double ms(uint64_t ns) {
+  return ns / 1000000.0;
+}
+
+int main(int argc, char **argv) {
+  uint16_t nodes = 255;
+  uint8_t baud = MD_BAUD_1250K;
+  uint32_t frames = 100;
+  uint32_t turnaroundUs = 1;
+  uint32_t seed = 1;
+  double ber = 0;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n")) nodes = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-b")) baud = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-l")) frameLen = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-f")) frames = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-t")) turnaroundUs = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-e")) ber = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-s")) seed = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (nodes < 1 || nodes > 255 || frameLen < 1 || frameLen > MD_MAX_DATA_LEN) {
+    fprintf(stderr, "Nodes need to be 1-255 and frame length 1-%d\n", MD_MAX_DATA_LEN);
+    return 2;
+  }
+
+  bus.setTurnaround(turnaroundUs * 1000);
+  bus.setBitErrorRate(ber);
+  bus.setSeed(seed);
+
+  // Build the floor
+  master.addNextDaisyChain(0, &masterPort.daisyDdr[0], &masterPort.daisyPort[0], &masterPort.daisyPin[0]);
+  for (uint16_t i = 0; i < nodes; i++) {
+    MultidropDataSim *port = new MultidropDataSim(&bus);
+    MultidropSlave *slave = new MultidropSlave(port);
+    slave->addDaisyChain(0, &port->daisyDdr[0], &port->daisyPort[0], &port->daisyPin[0],
+                         0, &port->daisyDdr[1], &port->daisyPort[1], &port->daisyPin[1]);
+    ports.push_back(port);
+    slaves.push_back(slave);
+    framesOk.push_back(0);
+  }
+  bus.chainDaisy();
+
+  if (baud >= MD_BAUD_COUNT || !(slaves[0]->getBaudMask() & (1 << baud))) {
+    fprintf(stderr, "Nodes can't run at baud rate %u\n", baud);
+    return 2;
+  }
+
+  clock_t wallStart = clock();
+
+  // Addressing
+  uint64_t start = bus.now();
+  MultidropMaster::adr_state_t state;
+
+  bus.resume();
+  master.startAddressing(bus.micros(), ADDR_TIMEOUT_US);
+  bus.syncDaisy(&masterPort);
+  do {
+    bus.advanceToNextByte(IDLE_STEP);
+    runSlaves();
+
+    bus.resume();
+    state = master.checkForAddresses(bus.micros());
+    bus.syncDaisy(&masterPort);
+  } while (state == MultidropMaster::ADR_WAITING);
+  drain();
+
+  printf("addressing: %u of %u nodes, %.2f ms\n", master.nodeNum, nodes, ms(bus.now() - start));
+  if (master.nodeNum != nodes) {
+    return 1;
+  }
+
+  // Baud rate, then check every node made it
+  uint8_t responses[255];
+  uint8_t defaultResponse[1] = { 0 };
+
+  if (baud != MD_BAUD_250K) {
+    bus.resume();
+    master.setBaud(baud);
+    drain();
+    bus.advance(MD_BAUD_SETTLE_US * 1000ULL);
+
+    if (!collectResponses(CMD_GET_PROTOCOL, responses, defaultResponse) ||
+        !master.checkBaud(responses, nodes)) {
+      drain();
+      printf("baud: not every node switched, back to %lu\n",
+             (unsigned long)Multidrop::baudRate(master.getBaud()));
+      return 1;
+    }
+  }
+  printf("baud: %lu\n", (unsigned long)Multidrop::baudRate(master.getBaud()));
+
+  // Frames
+  // (the data goes in one sendData() call, sending it a byte at a
+  // time turns the bus around between every byte)
+  std::vector<uint8_t> frame(nodes * frameLen);
+
+  start = bus.now();
+  for (frameNum = 0; frameNum < frames; frameNum++) {
+    for (uint16_t addr = 1; addr <= nodes; addr++) {
+      for (uint8_t b = 0; b < frameLen; b++) {
+        frame[(addr - 1) * frameLen + b] = frameByte(addr, frameNum, b);
+      }
+    }
+
+    bus.resume();
+    master.startMessage(CMD_SIM_FRAME, Multidrop::BROADCAST_ADDRESS, frameLen, true);
+    master.sendData(&frame[0], frame.size());
+    master.finishMessage();
+    drain();
+  }
+  uint64_t frameTime = bus.now() - start;
+
+  uint64_t okTotal = 0;
+  uint32_t okMin = frames;
+  uint32_t crcErrors = 0;
+  for (uint16_t i = 0; i < nodes; i++) {
+    okTotal += framesOk[i];
+    if (framesOk[i] < okMin) okMin = framesOk[i];
+    crcErrors += slaves[i]->getCrcErrors();
+  }
+
+  printf("frames: %u x %u bytes per node, %.3f ms per frame, %.1f frames/s\n",
+         frames, frameLen, ms(frameTime) / frames, frames / (frameTime / 1e9));
+  printf("received: %.2f%% (worst node %u of %u), %u CRC errors\n",
+         100.0 * okTotal / ((uint64_t)frames * nodes), okMin, frames, crcErrors);
+
+  // Batch response
+  uint16_t responded = 0;
+
+  start = bus.now();
+  collectResponses(CMD_GET_PROTOCOL, responses, defaultResponse);
+
+  for (uint16_t i = 0; i < nodes; i++) {
+    if (responses[i] == MD_PROTOCOL_VERSION) responded++;
+  }
+  printf("response: %u of %u nodes, %.2f ms\n", responded, nodes, ms(bus.now() - start));
+
+  printf("bus: %u bytes, %u bit errors, %u collisions\n", bus.bytesSent, bus.bitErrors, bus.collisions);
+  printf("simulated %.1f ms in %.2f s\n", ms(bus.now()), (double)(clock() - wallStart) / CLOCKS_PER_SEC);
+  return 0;
+}
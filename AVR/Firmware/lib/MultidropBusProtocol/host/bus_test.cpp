@@ -0,0 +1,339 @@
+/*******************************************************************************
+* Bus library tests
+*
+* Runs a master and slaves on the simulated bus through cases that have
+* broken before. Prints each case and exits with 1 if any failed.
+*
+*   ./bus_test
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "MultidropMaster.h"
+#include "MultidropSlave.h"
+#include "MultidropDataSim.h"
+
+// Longest step between bus events, in ns
+#define IDLE_STEP 10000
+
+static uint16_t failures = 0;
+
+static void check(uint8_t ok, const char *name) {
+  printf("%s: %s\n", ok ? "pass" : "FAIL", name);
+  if (!ok) failures++;
+}
+
+/*----------------------------------------------------------------------------
+                              bulk transfers
+----------------------------------------------------------------------------*/
+
+static uint8_t bulkReceived[256];
+static uint16_t bulkReceivedLen;
+
+static uint8_t bulkSink(uint8_t stream, uint16_t offset, uint8_t *data, uint8_t len) {
+  if (offset + len > sizeof(bulkReceived)) return 0;
+  memcpy(&bulkReceived[offset], data, len);
+  bulkReceivedLen = offset + len;
+  return 1;
+}
+
+// A window of chunks that all arrive before the node gets to read() them
+static void testBulkWindow() {
+  MultidropSimBus bus;
+  MultidropDataSim masterPort(&bus), slavePort(&bus);
+  MultidropMaster master(&masterPort);
+  MultidropSlave slave(&slavePort);
+  uint8_t data[96];
+
+  slave.addDaisyChain(0, &slavePort.daisyDdr[0], &slavePort.daisyPort[0], &slavePort.daisyPin[0],
+                      0, &slavePort.daisyDdr[1], &slavePort.daisyPort[1], &slavePort.daisyPin[1]);
+  slave.setAddress(1);
+  slave.setBulkSink(&bulkSink);
+  bulkReceivedLen = 0;
+
+  for (uint8_t i = 0; i < sizeof(data); i++) {
+    data[i] = i * 3 + 1;
+  }
+
+  bus.resume();
+  master.startBulk(sizeof(data), 32);
+  for (uint16_t seq = 0; seq < master.bulkChunkCount(); seq++) {
+    master.sendBulkChunk(seq, data);
+  }
+  bus.advance(bus.idleAt() - bus.now());
+
+  // Everything is buffered, one read() call gets it all
+  bus.resume();
+  while (slave.read());
+
+  check(bulkReceivedLen == sizeof(data) && !memcmp(bulkReceived, data, sizeof(data)),
+        "bulk: chunks buffered before one read() are all received");
+  check(slave.getBulkState() == BULK_DONE, "bulk: transfer done");
+}
+
+/*----------------------------------------------------------------------------
+                              baud rate
+----------------------------------------------------------------------------*/
+
+// A master and a few slaves, addressed 1 to n
+struct Floor {
+  MultidropSimBus bus;
+  MultidropDataSim masterPort;
+  MultidropMaster master;
+  MultidropDataSim *ports[4];
+  MultidropSlave *slaves[4];
+  uint8_t count;
+
+  Floor(uint8_t n) : masterPort(&bus), master(&masterPort), count(n) {
+    for (uint8_t i = 0; i < n; i++) {
+      ports[i] = new MultidropDataSim(&bus);
+      slaves[i] = new MultidropSlave(ports[i]);
+      slaves[i]->addDaisyChain(0, &ports[i]->daisyDdr[0], &ports[i]->daisyPort[0], &ports[i]->daisyPin[0],
+                               0, &ports[i]->daisyDdr[1], &ports[i]->daisyPort[1], &ports[i]->daisyPin[1]);
+      slaves[i]->setAddress(i + 1);
+    }
+    master.setNodeLength(n);
+  }
+
+  void runSlaves() {
+    for (uint8_t i = 0; i < count; i++) {
+      bus.resume();
+      while (slaves[i]->read());
+    }
+  }
+
+  // Run the slaves until everything on the bus has been received
+  void drain() {
+    while (bus.now() < bus.idleAt()) {
+      bus.advanceToNextByte(IDLE_STEP);
+      runSlaves();
+    }
+    runSlaves();
+  }
+
+  // Batch response message, all zeros for nodes that don't answer
+  void request(uint8_t command, uint8_t *responses, uint8_t len) {
+    uint8_t defaultResponse[MD_CAPS_LEN] = { 0 };
+
+    bus.resume();
+    master.startMessage(command, Multidrop::BROADCAST_ADDRESS, len, true, true);
+    master.setResponseSettings(responses, bus.micros(), 2000, defaultResponse);
+    do {
+      bus.advanceToNextByte(IDLE_STEP);
+      runSlaves();
+      bus.resume();
+    } while (!master.checkForResponses(bus.micros()));
+    drain();
+  }
+
+  // Batch CMD_GET_PROTOCOL, 0 for nodes that don't answer
+  void getProtocol(uint8_t *responses) {
+    request(CMD_GET_PROTOCOL, responses, 1);
+  }
+
+  // setBaud(), then check it
+  uint8_t switchBaud(uint8_t index) {
+    uint8_t responses[4];
+
+    bus.resume();
+    master.setBaud(index);
+    drain();
+    bus.advance(MD_BAUD_SETTLE_US * 1000ULL);
+
+    getProtocol(responses);
+    uint8_t ok = master.checkBaud(responses, count);
+    drain();
+    return ok;
+  }
+
+  // Every node answers at the master's current rate
+  uint8_t allAnswer() {
+    uint8_t responses[4];
+
+    getProtocol(responses);
+    for (uint8_t i = 0; i < count; i++) {
+      if (responses[i] != MD_PROTOCOL_VERSION) return 0;
+    }
+    return 1;
+  }
+};
+
+static void testBaudSwitch() {
+  Floor floor(3);
+
+  check(floor.switchBaud(MD_BAUD_1250K) && floor.master.getBaud() == MD_BAUD_1250K,
+        "baud: every node switches and answers the check");
+  check(floor.allAnswer(), "baud: every node answers at the new rate");
+}
+
+// One node stays at the old rate, so the whole bus goes back to it
+static void testBaudFallback() {
+  Floor floor(3);
+
+  floor.slaves[1]->setBaudMask(1 << MD_BAUD_250K);
+
+  check(!floor.switchBaud(MD_BAUD_1250K) && floor.master.getBaud() == MD_BAUD_250K,
+        "baud: a node that didn't switch fails the check");
+  check(floor.allAnswer(), "baud: every node answers at the old rate again");
+}
+
+/*----------------------------------------------------------------------------
+                              capabilities
+----------------------------------------------------------------------------*/
+
+// Start a dirty batch for node 2 only, and send it
+static void sendDirtyBatch(Floor &floor) {
+  uint8_t dirty[1] = { 1 << 1 };
+
+  floor.bus.resume();
+  floor.master.startDirtyBatch(0x10, 1, dirty);
+  for (uint16_t i = 0; i < floor.master.getBatchCount(); i++) {
+    floor.master.sendData(i);
+  }
+  floor.master.finishMessage();
+  floor.drain();
+}
+
+// Every node is on this firmware, so range and class messages can be used
+static void testCapsAllNew() {
+  Floor floor(3);
+  uint8_t responses[3 * MD_CAPS_LEN];
+  uint16_t counts[1] = { 3 };
+  uint8_t lengths[1] = { 1 };
+  md_caps_t caps;
+
+  floor.request(CMD_GET_CAPS, responses, MD_CAPS_LEN);
+  floor.master.combineCapabilities(responses, 3, &caps);
+  check(caps.version == MD_PROTOCOL_VERSION &&
+        (caps.features & (MD_FEATURE_RANGE | MD_FEATURE_CLASS)) == (MD_FEATURE_RANGE | MD_FEATURE_CLASS),
+        "caps: every node reports its features");
+
+  caps.bauds = 1 << MD_BAUD_250K; // Stay at this rate
+  floor.master.useCapabilities(&caps);
+  sendDirtyBatch(floor);
+  check(floor.master.getBatchStart() == 2 && floor.master.getBatchCount() == 1,
+        "caps: a dirty batch is sent as a range message");
+
+  floor.bus.resume();
+  check(floor.master.startClassMessage(0x10, 1, counts, lengths), "caps: class messages can be sent");
+  floor.master.sendData(0);
+  floor.master.sendData(0);
+  floor.master.sendData(0);
+  floor.master.finishMessage();
+  floor.drain();
+}
+
+// A node on older firmware answers CMD_GET_CAPS with whatever was in its
+// buffer, so it only adds the base rate, and the master stops using range
+// and class messages
+static void testCapsOldNode() {
+  Floor floor(3);
+  uint8_t responses[4 * MD_CAPS_LEN];
+  uint16_t counts[1] = { 3 };
+  uint8_t lengths[1] = { 1 };
+  md_caps_t caps;
+
+  floor.request(CMD_GET_CAPS, responses, MD_CAPS_LEN);
+  memset(&responses[3 * MD_CAPS_LEN], 0xFF, MD_CAPS_LEN);
+  responses[3 * MD_CAPS_LEN] = MD_EXT_PROTOCOL_VERSION;
+
+  floor.master.combineCapabilities(responses, 4, &caps);
+  check(caps.features == 0 && caps.bauds == (1 << MD_BAUD_250K),
+        "caps: an older node's stale answer adds no features and only the base rate");
+
+  check(floor.master.useCapabilities(&caps) == MD_BAUD_NONE && floor.master.getBaud() == MD_BAUD_250K,
+        "caps: the bus stays at the base rate");
+
+  sendDirtyBatch(floor);
+  check(floor.master.getBatchStart() == 1 && floor.master.getBatchCount() == 3,
+        "caps: a dirty batch falls back to a batch message");
+  check(!floor.master.startClassMessage(0x10, 1, counts, lengths),
+        "caps: class messages are refused");
+}
+
+/*----------------------------------------------------------------------------
+                              bit error rate test
+----------------------------------------------------------------------------*/
+
+// Run a bit error rate test at 1250K with `errorRate` noise, and get every node's results
+static void runBer(Floor &floor, uint8_t frames, uint8_t len, double errorRate, md_ber_t *results) {
+  uint8_t responses[3 * MD_BER_STATUS_LEN];
+  uint8_t defaultResponse[MD_BER_STATUS_LEN] = { 0 };
+
+  floor.bus.resume();
+  floor.master.berStart(0x1234, MD_BAUD_1250K, frames, len);
+  floor.drain();
+  floor.bus.advance(MD_BAUD_SETTLE_US * 1000ULL);
+
+  floor.bus.setBitErrorRate(errorRate);
+  for (uint8_t i = 0; i < frames; i++) {
+    floor.bus.resume();
+    floor.master.berSendFrame(len);
+    floor.drain();
+  }
+  floor.bus.resume();
+  floor.master.berFinish();
+  floor.drain();
+  floor.bus.setBitErrorRate(0);
+  floor.bus.advance(MD_BAUD_SETTLE_US * 1000ULL);
+
+  floor.bus.resume();
+  floor.master.startMessage(CMD_BER_STATUS, Multidrop::BROADCAST_ADDRESS, MD_BER_STATUS_LEN, true, true);
+  floor.master.setResponseSettings(responses, floor.bus.micros(), 2000, defaultResponse);
+  do {
+    floor.bus.advanceToNextByte(IDLE_STEP);
+    floor.runSlaves();
+    floor.bus.resume();
+  } while (!floor.master.checkForResponses(floor.bus.micros()));
+  floor.drain();
+
+  for (uint8_t i = 0; i < floor.count; i++) {
+    MultidropMaster::berResult(responses, i, &results[i]);
+  }
+}
+
+// The test rate is so noisy that nodes can't parse most frames, and they
+// still come back to the old rate on their own to report it
+static void testBerEnds() {
+  Floor floor(3);
+  md_ber_t results[3];
+  uint8_t frames = 20, answered = 0, errors = 0;
+
+  runBer(floor, frames, 16, 0.02, results);
+  for (uint8_t i = 0; i < 3; i++) {
+    if (results[i].bytes > 0) answered++;
+    if (results[i].byteErrors > 0 || results[i].frames < frames) errors++;
+  }
+  check(answered == 3, "ber: every node reports its results after a noisy test");
+  check(errors > 0, "ber: the noise shows up in the results");
+  check(floor.allAnswer(), "ber: every node is back at the old rate");
+}
+
+// Frames longer than 255 bytes on the wire are counted in full, so the
+// nodes stay at the test rate until the last one
+static void testBerLongFrames() {
+  Floor floor(3);
+  md_ber_t results[3];
+  uint8_t frames = 4, counted = 0;
+
+  runBer(floor, frames, 250, 0, results);
+  for (uint8_t i = 0; i < 3; i++) {
+    if (results[i].frames == frames && results[i].byteErrors == 0) counted++;
+  }
+  check(counted == 3, "ber: every long frame is counted, without errors");
+  check(floor.allAnswer(), "ber: every node is back at the old rate after long frames");
+}
+
+int main() {
+  testBulkWindow();
+  testBaudSwitch();
+  testBaudFallback();
+  testCapsAllNew();
+  testCapsOldNode();
+  testBerEnds();
+  testBerLongFrames();
+
+  printf("%u failed\n", failures);
+  return failures ? 1 : 0;
+}
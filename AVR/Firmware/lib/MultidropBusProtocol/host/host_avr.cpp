@@ -0,0 +1,40 @@
+/*******************************************************************************
+* Host AVR registers
+*
+* Definitions for the host stand-ins of the AVR headers (host/avr, host/util).
+******************************************************************************/
+
+#include <avr/io.h>
+#include <util/delay.h>
+#include "MultidropData.h"
+
+MdHostStatusReg UCSR0A;
+volatile uint8_t UCSR0B, UCSR0C, UDR0, UBRR0H, UBRR0L;
+volatile uint8_t md_host_io[64];
+
+void (*md_host_delay)(double us) = 0;
+
+MdHostStatusReg::operator uint8_t() const {
+  return value | (1 << UDRE0) | (1 << TXC0);
+}
+
+void _delay_us(double us) {
+  if (md_host_delay) {
+    md_host_delay(us);
+  }
+}
+
+void _delay_ms(double ms) {
+  _delay_us(ms * 1000.0);
+}
+
+// MultidropData's own methods are never called, but unoptimized host builds
+// still need its vtable
+void MultidropData::begin(uint32_t) { }
+uint8_t MultidropData::available() { return 0; }
+uint8_t MultidropData::read() { return 0xFF; }
+void MultidropData::write(uint8_t) { }
+void MultidropData::flush() { }
+void MultidropData::clear() { }
+void MultidropData::enable_write() { }
+void MultidropData::enable_read() { }
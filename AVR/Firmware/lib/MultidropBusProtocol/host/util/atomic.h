@@ -0,0 +1,14 @@
+/**
+ * Host stand-in for <util/atomic.h>.
+ *
+ * The host build is single threaded, so an atomic block runs its body once.
+ */
+
+#ifndef MD_HOST_UTIL_ATOMIC_H
+#define MD_HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) if (1)
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * Host stand-in for <util/crc16.h>.
+ *
+ * The same CRC-16 (polynomial 0xA001, reflected) as avr-libc's _crc16_update(),
+ * written out as its C equivalent.
+ */
+
+#ifndef MD_HOST_UTIL_CRC16_H
+#define MD_HOST_UTIL_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a) {
+  crc ^= a;
+  for (uint8_t i = 0; i < 8; ++i) {
+    if (crc & 1) {
+      crc = (crc >> 1) ^ 0xA001;
+    } else {
+      crc = (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+#endif
@@ -0,0 +1,17 @@
+/**
+ * Host stand-in for <util/delay.h>.
+ *
+ * Delays don't block. They're passed to md_host_delay, if it's set, so a
+ * simulation can account for them (see MultidropDataSim).
+ */
+
+#ifndef MD_HOST_UTIL_DELAY_H
+#define MD_HOST_UTIL_DELAY_H
+
+// Called with the length of every delay, in microseconds
+extern void (*md_host_delay)(double us);
+
+void _delay_us(double us);
+void _delay_ms(double ms);
+
+#endif
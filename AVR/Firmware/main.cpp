@@ -9,14 +9,26 @@
 #include <avr/io.h>
 #include <avr/wdt.h>
 #include <avr/eeprom.h> 
+#include <string.h>
 
 #include "pwm.h"
+#include "color.h"
 #include "clock.h"
 #include "touch.h"
 #include "touch_control.h"
+#include "touch_history.h"
+#include "sense_schedule.h"
+#include "health.h"
+#include "config.h"
+#include "trace.h"
+#include "fade.h"
+#include "scenes.h"
+#include "geometry.h"
+#include "effects.h"
 #include "touch_api.h"
 #include "MultidropSlave.h"
 #include "MultidropData485.h"
+#include "MultidropBoot.h"
 #include "version.h"
 
 /*----------------------------------------------------------------------------
@@ -28,13 +40,36 @@ void comm_run();
 void handle_message();
 void handle_response_msg(uint8_t command, uint8_t *buff,uint8_t len);
 void set_color(uint8_t *rgb);
+void set_color16(uint16_t red, uint16_t green, uint16_t blue);
+void color_init_from_config();
+void show_boot_look();
+void run_fade();
+void run_effect();
+void show_scene(uint8_t index);
+void draw_shape(uint8_t *data, uint8_t len);
+void touch_reflex(uint8_t touched);
 void read_sensor();
+void set_detect_threshold(uint8_t threshold, uint8_t hysteresis);
 
 /*----------------------------------------------------------------------------
                                 constants
 ----------------------------------------------------------------------------*/
 
 #define BUS_BAUD 250000
+
+// Baud rates the node will switch to when the master asks (CMD_SET_BAUD)
+#define BUS_BAUDS ((1 << MD_BAUD_250K) | (1 << MD_BAUD_312K) | (1 << MD_BAUD_625K))
+
+// Application features, reported to the master with CMD_GET_CAPS
+#define FEATURE_TOUCH_HISTORY 0x01
+#define FEATURE_SENSE_SLOTS   0x02
+#define FEATURE_TOUCH_PROFILE 0x04 // Robust and fast sensor modes
+#define FEATURE_COLOR_16      0x08
+#define FEATURE_SCENES        0x10
+#define FEATURE_GEOMETRY      0x20
+#define FEATURE_EFFECTS       0x40
+#define APP_FEATURES (FEATURE_TOUCH_HISTORY | FEATURE_SENSE_SLOTS | FEATURE_TOUCH_PROFILE | \
+                      FEATURE_COLOR_16 | FEATURE_SCENES | FEATURE_GEOMETRY | FEATURE_EFFECTS)
 #define DEFAULT_DETECT_THRES 11u
 
 // Message commands
@@ -45,16 +80,46 @@ void read_sensor();
 #define CMD_SET_COLOR         0xA1
 #define CMD_CHECK_SENSOR      0xA2
 #define CMD_SEND_SENSOR_VALUE 0xA3
-
-#define CMD_SET_DETECT_THRESH 0xB0 // Set the QTouch detection threshold
+#define CMD_GET_TOUCH_HISTORY 0xA4 // Drain the timestamped sensor transitions
+#define CMD_SET_SENSOR_RATE   0xA5 // Sample the sensor on our own every N milliseconds
+#define CMD_SET_SENSE_SLOT    0xA6 // Assign the sensing slot (batch, 1 byte per node)
+#define CMD_SENSE_SYNC        0xA7 // Start a sensing cycle: slot width (ms), number of slots
+#define CMD_SET_REFLEX        0xA8 // Set the color to change to, on our own, when touched
+#define CMD_SET_COLOR_16      0xA9 // Set the LED color with 16-bit values (12-bit output)
+#define CMD_SET_SCENE         0xAA // Upload a scene: index, r, g, b, fade time (ms)
+#define CMD_SAVE_SCENES       0xAB // Save all scenes to the EEPROM
+#define CMD_RECALL_SCENE      0xAC // Display a scene: index, delay (ms)
+#define CMD_GET_HEALTH        0xAD // Return the node health counters (batch, 15 bytes per node)
+#define CMD_RESET_HEALTH      0xAE // Reset the node health counters
+#define CMD_GET_TRACE         0xAF // Drain the trace ring (TRACE builds only, see trace.h)
+
+#define CMD_SET_DETECT_THRESH 0xB0 // Set the QTouch detection threshold (and hysteresis)
+#define CMD_CALIBRATE_SENSOR  0xB1 // Run a touch sensor calibration phase
+#define CMD_GET_DETECT_THRESH 0xB2 // Return the detection settings and calibration stats
+#define CMD_SET_TOUCH_PROFILE 0xB3 // Switch between the robust and fast detection profiles
+#define CMD_GET_TOUCH_STATS   0xB4 // Return the acquisition timing stats since the last acknowledged report
+#define CMD_ACK_TOUCH_HISTORY 0xB5 // Remove the touch history that was received (batch, 1 byte per node: its sequence number)
+#define CMD_ACK_TOUCH_STATS   0xB6 // Start a new touch stats window (batch, 1 byte per node: the report's sequence number)
+
+#define CMD_SET_WHITE_BALANCE 0xC0 // Set the red, green and blue gains for this node
+#define CMD_SET_DIMMER        0xC1 // Set the master brightness
+#define CMD_SET_GAMMA         0xC2 // Turn gamma correction on (1) or off (0)
+#define CMD_SET_BOOT_LOOK     0xC3 // What to show at power on: nothing (current color), scene index, or r, g, b
+
+#define CMD_SET_POSITION      0xD0 // Set our x/y position on the floor grid
+#define CMD_DRAW_SHAPE        0xD1 // Shape, blend mode, r, g, b, shape params
+#define CMD_SET_EFFECT        0xD2 // Start a wave effect (see effects.h)
+
+#define CMD_SET_TRACE_MASK    0xE0 // Choose which events go into the trace ring (TRACE builds only)
+#define CMD_ACK_TRACE         0xE1 // Remove the trace events that were received (batch, 1 byte per node: the sequence number)
+
+// Touch reflex flags
+#define REFLEX_ENABLED       0x01
+#define REFLEX_RELEASE_FRAME 0x02 // On release, go back to the last color set by the master
 
 // EEPROM byte addresses
-
-// Since node addresses can go up to 0xFF and EEPROM default values are 0xFF, 
-// we need to have an extra byte to tell us if the address has been set.
-#define EEPROM_HAS_ADDR      (uint8_t*)0
-#define EEPROM_ADDR          (uint8_t*)1
-#define EEPROM_DETECT_THRESH (uint8_t*)2
+// (the node settings are in their own block, see config.h)
+#define EEPROM_SCENES        (uint8_t*)16 // SCENE_COUNT * SCENE_SIZE bytes
 
 /*----------------------------------------------------------------------------
                           global variables
@@ -64,8 +129,23 @@ void read_sensor();
 uint8_t sensor_value = 0;
 uint8_t reading_sensor = 0;
 
-// Bus serial
-MultidropData485 serial(PD2, &DDRD, &PORTD);
+// The color currently displayed, and the last color the master sent
+uint8_t current_color[3] = {0, 0, 0};
+uint8_t frame_color[3] = {0, 0, 0};
+
+// Touch reflex settings
+uint8_t reflex_flags = 0;
+uint8_t reflex_touch_color[3];
+uint8_t reflex_release_color[3];
+uint16_t reflex_decay = 0; // Fade time, in milliseconds, back to the release color
+uint8_t reflex_active = 0; // The touch color is being shown
+
+// Touch detection settings
+uint8_t detect_threshold;
+uint8_t detect_hysteresis;
+
+// Bus serial (DE on PD2)
+MultidropData485Pin<MdPin<MD_PORTD_IO, PD2> > serial;
 MultidropSlave comm(&serial);
 
 /*----------------------------------------------------------------------------
@@ -76,26 +156,59 @@ MultidropSlave comm(&serial);
  * Main program
  */
 int main() {
+  uint8_t reset_flags = MCUSR;
+  MCUSR = 0;
   wdt_disable();
   wdt_enable(WDTO_2S);
+  health_init(reset_flags);
 
   DDRB |= (1 << PB2); // debug LED
+#ifdef TRACE
+  trace_init();
+#endif
   
+  // Settings first, so we can answer the bus and light up before the slower setup
+  config_t *config = config_get();
+  config_load();
+
   start_clock();
   comm_init();
   pwm_init();
+  color_init_from_config();
+  scene_load(EEPROM_SCENES);
+  show_boot_look();
+  geometry_set_position(config->position[0], config->position[1]);
 
   // Setup touch sensor
-  uint8_t detect_threshold = eeprom_read_byte(EEPROM_DETECT_THRESH);
+  detect_threshold = config->detect_threshold;
   if (detect_threshold == 0xFF) {
     detect_threshold = DEFAULT_DETECT_THRES;
   }
-  touch_init(detect_threshold);
+  detect_hysteresis = config->detect_hysteresis;
+  if (detect_hysteresis > HYST_6_25) {
+    detect_hysteresis = HYST_6_25;
+  }
+  touch_init(detect_threshold, detect_hysteresis);
+  touch_set_profile(config->touch_profile);
 
   // Program loop
   while(1) {
     wdt_reset();
+    TRACE_MARK(LOOP);
+    health_loop(millis(), micros());
     comm_run();
+
+    // Calibration samples the sensor continuously
+    if (touch_calibrating()) {
+      read_sensor();
+    }
+    else if (sense_schedule_due(millis())) {
+      read_sensor();
+    }
+
+    show_scene(scene_due(millis()));
+    run_fade();
+    run_effect();
   }
 }
 
@@ -108,17 +221,24 @@ void comm_init() {
 
   serial.begin(BUS_BAUD);
   
-  // Define daisy chain lines and let polarity (next/previous) be determined at runtime
-  comm.addDaisyChain(PC3, &DDRC, &PORTC, &PINC,
-                     PC4, &DDRC, &PORTC, &PINC);
+  // Daisy chain lines are PC3 & PC4 (MD_DAISY*_PIN in the Makefile),
+  // polarity (next/previous) is determined at runtime
+  comm.addDaisyChain();
 
   // Response message handler
   comm.setResponseHandler(&handle_response_msg);
 
-  // Check if we have an address in the EEPROM
-  uint8_t addr = eeprom_read_byte(EEPROM_ADDR);
-  if (addr > 0 && eeprom_read_byte(EEPROM_HAS_ADDR) == 1) {
-    comm.setAddress(addr);
+  // What we tell the master we support
+  comm.setCapabilities(APP_FEATURES, UART0_RX_BUFFER_SIZE);
+  comm.setBaudMask(BUS_BAUDS & comm.getBaudMask());
+
+  // Our saved address and class
+  config_t *config = config_get();
+  if (config->address > 0) {
+    comm.setAddress(config->address);
+  }
+  if (config->node_class != Multidrop::NO_CLASS) {
+    comm.setNodeClass(config->node_class, config->class_index);
   }
 }
 
@@ -140,21 +260,205 @@ void handle_message() {
     // We've been assigned an address
     case CMD_SET_ADDRESS:
       if (comm.getAddress() > 0) {
-        eeprom_update_byte(EEPROM_HAS_ADDR, 1);
-        eeprom_update_byte(EEPROM_ADDR, comm.getAddress());
+        config_get()->address = comm.getAddress();
+        config_save();
       }
     break;
 
+    // Keep the class the library was just given
+    case CMD_SET_CLASS:
+      config_get()->node_class = comm.getNodeClass();
+      config_get()->class_index = comm.getClassIndex();
+      config_save();
+    break;
+
+    // Restart into the bootloader for a firmware update (see MultidropBoot.h)
+    case CMD_BOOT_ENTER:
+      eeprom_update_byte(BOOT_EEPROM_FLAG, BOOT_FLAG_UPDATE);
+      wdt_enable(WDTO_15MS);
+      while(1);
+    break;
+
     // Reset address saved in the eeprom
     case CMD_RESET_NODE:
-      eeprom_update_byte(EEPROM_HAS_ADDR, 0);
-      eeprom_update_byte(EEPROM_ADDR, 0);
+      config_get()->address = 0;
+      config_save();
     break;
 
     // Set the LED color
     case CMD_SET_COLOR:
       if (comm.getDataLen() == 3) {
-        set_color(comm.getData());
+        uint8_t *rgb = comm.getData();
+        frame_color[0] = rgb[0];
+        frame_color[1] = rgb[1];
+        frame_color[2] = rgb[2];
+
+        // The master's color always wins over a reflex
+        fade_stop();
+        effect_stop();
+        set_color(rgb);
+      }
+    break;
+
+    // Set the LED color in high resolution (3 big endian 16-bit values)
+    case CMD_SET_COLOR_16:
+      if (comm.getDataLen() == 6) {
+        uint8_t *data = comm.getData();
+        frame_color[0] = data[0];
+        frame_color[1] = data[2];
+        frame_color[2] = data[4];
+
+        fade_stop();
+        effect_stop();
+        set_color16((data[0] << 8) | data[1],
+                    (data[2] << 8) | data[3],
+                    (data[4] << 8) | data[5]);
+      }
+    break;
+
+    // Upload a scene into RAM
+    case CMD_SET_SCENE:
+      if (comm.getDataLen() == 6) {
+        scene_set(comm.getData()[0], &comm.getData()[1]);
+      }
+    break;
+
+    // Keep the scenes after a reboot.
+    // (This blocks for several ms per scene, so give nodes time before the next message)
+    case CMD_SAVE_SCENES:
+      scene_save(EEPROM_SCENES);
+    break;
+
+    // Show a scene, now or after a delay
+    case CMD_RECALL_SCENE:
+      if (comm.getDataLen() >= 1) {
+        uint8_t *data = comm.getData();
+        uint16_t delay = (comm.getDataLen() == 3) ? (data[1] << 8) | data[2] : 0;
+        scene_recall(data[0], delay, millis());
+        show_scene(scene_due(millis()));
+      }
+    break;
+
+    // Start counting health stats from zero
+    case CMD_RESET_HEALTH:
+      comm.resetCounters();
+      serial.resetErrors();
+      health_reset();
+    break;
+
+#ifdef TRACE
+    // Events to log into the trace ring
+    case CMD_SET_TRACE_MASK:
+      if (comm.getDataLen() == 1) {
+        trace_set_mask(comm.getData()[0]);
+      }
+    break;
+
+    // The master received this trace response
+    case CMD_ACK_TRACE:
+      if (comm.getDataLen() == 1) {
+        trace_ack(comm.getData()[0]);
+      }
+    break;
+#endif
+
+    // Our position on the floor grid
+    case CMD_SET_POSITION:
+      if (comm.getDataLen() == 2) {
+        uint8_t *data = comm.getData();
+        config_get()->position[0] = data[0];
+        config_get()->position[1] = data[1];
+        config_save();
+        geometry_set_position(data[0], data[1]);
+      }
+    break;
+
+    // Draw a shape on the floor
+    case CMD_DRAW_SHAPE:
+      draw_shape(comm.getData(), comm.getDataLen());
+    break;
+
+    // Animate the floor on our own
+    case CMD_SET_EFFECT:
+      if (comm.getDataLen() == EFFECT_MSG_LEN) {
+        fade_stop();
+        effect_start(comm.getData(), millis());
+      }
+      else if (comm.getDataLen() == 1) {
+        effect_stop();
+      }
+    break;
+
+    // Set the white balance gains and save them
+    case CMD_SET_WHITE_BALANCE:
+      if (comm.getDataLen() == 3) {
+        memcpy(config_get()->white_balance, comm.getData(), 3);
+        config_save();
+        color_set_white_balance(comm.getData());
+      }
+    break;
+
+    // Dim or brighten the whole floor
+    case CMD_SET_DIMMER:
+      if (comm.getDataLen() == 1) {
+        color_set_dimmer(comm.getData()[0]);
+      }
+    break;
+
+    // Turn gamma correction on/off and save it
+    case CMD_SET_GAMMA:
+      if (comm.getDataLen() == 1) {
+        config_get()->gamma = comm.getData()[0] != 0;
+        config_save();
+        color_set_gamma(config_get()->gamma);
+        set_color(current_color);
+      }
+    break;
+
+    // Choose what to show at power on, before the master takes over:
+    //   no data: the color showing now
+    //   1 byte:  a stored scene (SCENE_NONE to stay dark)
+    //   3 bytes: a color
+    case CMD_SET_BOOT_LOOK: {
+      config_t *config = config_get();
+      uint8_t *data = comm.getData();
+
+      if (comm.getDataLen() == 0) {
+        config->boot_look = CONFIG_BOOT_COLOR;
+        memcpy(config->boot_color, current_color, 3);
+      }
+      else if (comm.getDataLen() == 1) {
+        config->boot_look = (data[0] == SCENE_NONE) ? CONFIG_BOOT_DARK : CONFIG_BOOT_SCENE;
+        config->boot_scene = data[0];
+      }
+      else if (comm.getDataLen() == 3) {
+        config->boot_look = CONFIG_BOOT_COLOR;
+        memcpy(config->boot_color, data, 3);
+      }
+      config_save();
+    }
+    break;
+
+    // Setup the touch reflex
+    //   [0]    Flags (REFLEX_*)
+    //   [1..3] Touch color
+    //   [4..6] Release color
+    //   [7..8] Release fade time, in milliseconds (big endian)
+    case CMD_SET_REFLEX:
+      reflex_active = 0;
+      if (comm.getDataLen() == 1) {
+        reflex_flags = comm.getData()[0];
+      }
+      else if (comm.getDataLen() == 9) {
+        uint8_t *data = comm.getData();
+        reflex_flags = data[0];
+        reflex_touch_color[0] = data[1];
+        reflex_touch_color[1] = data[2];
+        reflex_touch_color[2] = data[3];
+        reflex_release_color[0] = data[4];
+        reflex_release_color[1] = data[5];
+        reflex_release_color[2] = data[6];
+        reflex_decay = (data[7] << 8) | data[8];
       }
     break;
 
@@ -163,12 +467,77 @@ void handle_message() {
       read_sensor();
     break;
 
-    // Set the touch sensor detect threshold
+    // Set how often we check the sensor ourselves
+    case CMD_SET_SENSOR_RATE:
+      if (comm.getDataLen() == 1) {
+        sense_schedule_interval(millis(), comm.getData()[0]);
+      }
+    break;
+
+    // The master received this touch history response
+    case CMD_ACK_TOUCH_HISTORY:
+      if (comm.getDataLen() == 1) {
+        touch_history_ack(comm.getData()[0]);
+      }
+    break;
+
+    // The master received this touch stats report
+    case CMD_ACK_TOUCH_STATS:
+      if (comm.getDataLen() == 1) {
+        touch_ack_stats(comm.getData()[0]);
+      }
+    break;
+
+    // Assign our sensing slot
+    case CMD_SET_SENSE_SLOT:
+      if (comm.getDataLen() == 1) {
+        sense_schedule_set_slot(comm.getData()[0]);
+      }
+    break;
+
+    // Sync the sensing cycle and wait for our slot
+    case CMD_SENSE_SYNC:
+      if (comm.getDataLen() == 2) {
+        uint8_t *data = comm.getData();
+        sense_schedule_sync(millis(), data[0], data[1], comm.getAddress());
+      }
+    break;
+
+    // Set the touch sensor detect threshold and, optionally, hysteresis.
+    // A threshold of 0 leaves this node unchanged, so batch messages can skip nodes.
     case CMD_SET_DETECT_THRESH:
+      if (comm.getDataLen() >= 1 && comm.getData()[0] > 0) {
+        uint8_t *data = comm.getData();
+        uint8_t hyst = (comm.getDataLen() >= 2) ? data[1] : detect_hysteresis;
+        set_detect_threshold(data[0], hyst);
+      }
+    break;
+
+    // Trade noise immunity for latency
+    case CMD_SET_TOUCH_PROFILE:
+      if (comm.getDataLen() == 1) {
+        touch_set_profile(comm.getData()[0]);
+        config_get()->touch_profile = touch_get_profile();
+        config_save();
+      }
+    break;
+
+    // Calibrate the touch sensor:
+    //  TOUCH_CAL_NOISE: start sampling the idle noise floor
+    //  TOUCH_CAL_TOUCH: start sampling the touch delta
+    //  TOUCH_CAL_OFF:   choose and save the new threshold and hysteresis
+    case CMD_CALIBRATE_SENSOR:
       if (comm.getDataLen() == 1) {
-        uint8_t dt = comm.getData()[0]; 
-        eeprom_update_byte(EEPROM_DETECT_THRESH, dt);
-        touch_init(dt);
+        uint8_t phase = comm.getData()[0];
+
+        if (phase == TOUCH_CAL_OFF) {
+          uint8_t thresh, hyst;
+          if (touch_calibrate_finish(&thresh, &hyst)) {
+            set_detect_threshold(thresh, hyst);
+          }
+        } else {
+          touch_calibrate_start(phase);
+        }
       }
     break;
   }
@@ -193,16 +562,243 @@ void handle_response_msg(uint8_t command, uint8_t *buff, uint8_t len) {
         buff[0] = sensor_value;
       }
     break;
+
+    // Send the sensor transitions the master hasn't acknowledged yet
+    case CMD_GET_TOUCH_HISTORY:
+      touch_history_drain(buff, len, millis());
+    break;
+
+    // Send the acquisition stats (big endian) since the last acknowledged
+    // report, and its sequence number for CMD_ACK_TOUCH_STATS
+    case CMD_GET_TOUCH_STATS:
+      if (len >= 14) {
+        uint8_t seq;
+        touch_stats_t *stats = touch_report_stats(&seq);
+        buff[0]  = stats->reads >> 8;
+        buff[1]  = stats->reads & 0xFF;
+        buff[2]  = stats->bursts >> 8;
+        buff[3]  = stats->bursts & 0xFF;
+        buff[4]  = stats->last_read_us >> 8;
+        buff[5]  = stats->last_read_us & 0xFF;
+        buff[6]  = stats->max_read_us >> 8;
+        buff[7]  = stats->max_read_us & 0xFF;
+        buff[8]  = stats->max_burst_us >> 8;
+        buff[9]  = stats->max_burst_us & 0xFF;
+        buff[10] = stats->last_bursts;
+        buff[11] = stats->max_bursts;
+        buff[12] = touch_get_profile();
+        buff[13] = seq;
+      }
+    break;
+
+    // Node health: bus errors, message count, resets and timing
+    case CMD_GET_HEALTH:
+      if (len >= 15) {
+        uint16_t counts[5] = {
+          comm.getCrcErrors(),
+          serial.getFrameErrors(),
+          serial.getOverruns(),
+          serial.getRxOverflows(),
+          comm.getMessageCount()
+        };
+        uint16_t loop_us = health_max_loop_us();
+        uint16_t bursts = health_touch_bursts();
+
+        for (uint8_t i = 0; i < 5; i++) {
+          buff[i * 2] = counts[i] >> 8;
+          buff[i * 2 + 1] = counts[i] & 0xFF;
+        }
+        buff[10] = health_wdt_resets();
+        buff[11] = loop_us >> 8;
+        buff[12] = loop_us & 0xFF;
+        buff[13] = bursts >> 8;
+        buff[14] = bursts & 0xFF;
+      }
+    break;
+
+#ifdef TRACE
+    // Oldest trace events, as many as fit (see trace_drain)
+    case CMD_GET_TRACE:
+      trace_drain(buff, len);
+    break;
+#endif
+
+    // Send the detection settings, followed by the last calibration stats
+    case CMD_GET_DETECT_THRESH:
+      if (len >= 2) {
+        buff[0] = detect_threshold;
+        buff[1] = detect_hysteresis;
+      }
+      if (len >= 4) {
+        buff[2] = touch_calibrate_noise();
+        buff[3] = touch_calibrate_peak();
+      }
+    break;
+  }
+}
+
+/**
+ * Apply and save new touch detection settings.
+ */
+void set_detect_threshold(uint8_t threshold, uint8_t hysteresis) {
+  if (hysteresis > HYST_6_25) {
+    hysteresis = HYST_6_25;
   }
+  detect_threshold = threshold;
+  detect_hysteresis = hysteresis;
+
+  config_get()->detect_threshold = threshold;
+  config_get()->detect_hysteresis = hysteresis;
+  config_save();
+  touch_init(threshold, hysteresis);
 }
 
 /**
  * Update RGB LED values
  */
 void set_color(uint8_t *rgb) {
-  red_pwm(rgb[0]);
-  green_pwm(rgb[1]);
-  blue_pwm(rgb[2]);
+  current_color[0] = rgb[0];
+  current_color[1] = rgb[1];
+  current_color[2] = rgb[2];
+
+  color_set(rgb);
+}
+
+/**
+ * Update RGB LED values with 16-bit precision
+ */
+void set_color16(uint16_t red, uint16_t green, uint16_t blue) {
+  current_color[0] = red >> 8;
+  current_color[1] = green >> 8;
+  current_color[2] = blue >> 8;
+
+  color_set16(red, green, blue);
+}
+
+/**
+ * Setup the color pipeline from the saved settings.
+ */
+void color_init_from_config() {
+  config_t *config = config_get();
+
+  // An unprogrammed EEPROM reads 0xFF, which leaves the gains at full. Gamma is
+  // only on once CMD_SET_GAMMA has saved a 1, so colors look as they always have.
+  color_init(config->gamma == 1, config->white_balance);
+}
+
+/**
+ * Show the saved power on look (see CMD_SET_BOOT_LOOK).
+ */
+void show_boot_look() {
+  config_t *config = config_get();
+
+  if (config->boot_look == CONFIG_BOOT_COLOR) {
+    memcpy(frame_color, config->boot_color, 3);
+    set_color(config->boot_color);
+  }
+  else if (config->boot_look == CONFIG_BOOT_SCENE) {
+    show_scene(config->boot_scene);
+  }
+}
+
+/**
+ * Move the current fade along.
+ */
+void run_fade() {
+  uint8_t rgb[3];
+  if (fade_running()) {
+    fade_step(millis(), rgb);
+    set_color(rgb);
+  }
+}
+
+/**
+ * Update the current effect, unless a reflex or fade is showing over it.
+ */
+void run_effect() {
+  uint8_t rgb[3];
+  static uint16_t last_update = 0;
+  uint16_t now = millis();
+
+  if (!effect_running() || reflex_active || fade_running() || now == last_update) return;
+
+  last_update = now;
+  effect_step(now, rgb);
+  set_color(rgb);
+}
+
+/**
+ * Change to one of our stored scenes.
+ */
+void show_scene(uint8_t index) {
+  scene_t *scene = scene_get(index);
+  if (!scene) return;
+
+  effect_stop();
+  frame_color[0] = scene->rgb[0];
+  frame_color[1] = scene->rgb[1];
+  frame_color[2] = scene->rgb[2];
+
+  if (scene->fade) {
+    fade_start(current_color, scene->rgb, scene->fade, millis());
+  } else {
+    fade_stop();
+    set_color(scene->rgb);
+  }
+}
+
+/**
+ * Update our color if we're part of a shape drawn on the floor.
+ *   [0]    Shape (SHAPE_*)
+ *   [1]    Blend mode (BLEND_*)
+ *   [2..4] Color
+ *   [5..]  Shape params
+ */
+void draw_shape(uint8_t *data, uint8_t len) {
+  uint8_t rgb[3];
+  uint8_t black[3] = {0, 0, 0};
+
+  if (len < 5 || !geometry_has_position()) return;
+
+  if (geometry_contains(data[0], &data[5], len - 5)) {
+    geometry_blend(data[1], current_color, &data[2], rgb);
+  }
+  else if (data[1] & BLEND_CLEAR_OUTSIDE) {
+    geometry_blend(BLEND_REPLACE, current_color, black, rgb);
+  }
+  else {
+    return;
+  }
+
+  frame_color[0] = rgb[0];
+  frame_color[1] = rgb[1];
+  frame_color[2] = rgb[2];
+
+  fade_stop();
+  effect_stop();
+  set_color(rgb);
+}
+
+/**
+ * Change color on our own when the sensor changes, without waiting on the master.
+ */
+void touch_reflex(uint8_t touched) {
+  if (!(reflex_flags & REFLEX_ENABLED)) return;
+
+  reflex_active = touched;
+
+  if (touched) {
+    fade_stop();
+    set_color(reflex_touch_color);
+  }
+  else {
+    uint8_t *to = (reflex_flags & REFLEX_RELEASE_FRAME) ? frame_color : reflex_release_color;
+    if (reflex_decay) {
+      fade_start(current_color, to, reflex_decay, millis());
+    } else {
+      set_color(to);
+    }
+  }
 }
 
 /**
@@ -212,6 +808,8 @@ void read_sensor() {
   if (reading_sensor) return;
   reading_sensor = 1;
 
+  uint8_t last_value = sensor_value;
+
   // Default MCU register value
   uint8_t mcuRegister = MCUCR;
   uint16_t status_flag = 0u;
@@ -221,7 +819,7 @@ void read_sensor() {
     MCUCR |= (1 << PUD);
 
     // Measure sensor
-    status_flag = qt_measure_sensors( millis() );
+    status_flag = touch_burst( millis() );
     
     // Reset pull-ups
     MCUCR = mcuRegister;
@@ -234,6 +832,15 @@ void read_sensor() {
   sensor_value = GET_SENSOR_STATE(0);
   reading_sensor = 0;
 
+  if (sensor_value != last_value) {
+    touch_reflex(sensor_value);
+    touch_history_push(sensor_value, millis());
+  }
+
+  if (touch_calibrating()) {
+    touch_calibrate_sample();
+  }
+
   // Debug LED
   if (sensor_value) {
     PORTB |= (1 << PB2);
@@ -0,0 +1,45 @@
+## Compare perf results with the baseline, lower is better for all of them.
+##
+##   awk -f compare.awk baseline.txt results.txt
+##
+## baseline.txt: name, baseline value, tolerance (percent) on each line
+## results.txt:  name, value on each line
+## Exits with 1 if any value is over its baseline plus tolerance, or missing.
+
+FNR == NR {
+  if ($0 ~ /^#/ || NF < 2) next
+  base[$1] = $2
+  tol[$1] = (NF >= 3) ? $3 : 0
+  order[++count] = $1
+  next
+}
+
+NF >= 2 {
+  value[$1] = $2
+}
+
+END {
+  failed = 0
+  printf "%-24s %12s %12s %8s\n", "", "baseline", "now", "change"
+  for (i = 1; i <= count; i++) {
+    name = order[i]
+    if (!(name in value)) {
+      printf "%-24s %12s %12s %8s  FAIL (missing)\n", name, base[name], "-", ""
+      failed = 1
+      continue
+    }
+    change = (base[name] > 0) ? (value[name] - base[name]) * 100 / base[name] : 0
+    status = ""
+    if (value[name] > base[name] * (1 + tol[name] / 100)) {
+      status = sprintf("  FAIL (over %s%%)", tol[name])
+      failed = 1
+    }
+    printf "%-24s %12s %12s %+7.1f%%%s\n", name, base[name], value[name], change, status
+  }
+  for (name in value) {
+    if (!(name in base)) {
+      printf "%-24s %12s %12s %8s  (not in the baseline)\n", name, "-", value[name], ""
+    }
+  }
+  exit failed
+}
@@ -0,0 +1,462 @@
+/*******************************************************************************
+* Performance harness
+*
+* Runs the node firmware under simavr, feeds it the bus traffic from a script
+* (see traffic.txt) and times it, in CPU cycles:
+*
+*   rx_isr_cycles_max/avg  The UART receive interrupt
+*   parse_cycles_per_byte  MultidropSlave::parse(), for each byte (without
+*   parse_cycles_max       the interrupts that fire while it runs)
+*   loop_sense_cycles_max  The longest main loop period (from one
+*                          health_loop() call to the next, which only the
+*                          main loop makes) that included a read_sensor()
+*   turnaround_us_max/avg  From the end of the last byte the node received
+*                          to the first byte of its response
+*
+* The functions are found by their address, which the Makefile looks up with
+* avr-nm and passes in as name=0xaddress:
+*
+*   perf_harness node.elf traffic.txt rx_isr=0x... parse=0x... loop=0x... sense=0x...
+*
+* Results are printed as "name value" lines, for compare.awk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_irq.h>
+#include <avr_uart.h>
+#include <avr_ioport.h>
+
+#define MCU      "atmega328p"
+#define F_CPU    20000000UL
+#define BUS_BAUD 250000UL
+
+// CPU cycles for one byte on the bus (start, 8 data and stop bits)
+#define BYTE_CYCLES (F_CPU * 10 / BUS_BAUD)
+
+#define MAX_LINES 256
+#define MAX_QUEUE 1024
+
+static avr_t *avr;
+static avr_irq_t *uart_in;
+static avr_irq_t *daisy_pins[2];
+
+/*----------------------------------------------------------------------------
+                              timed functions
+----------------------------------------------------------------------------*/
+
+typedef struct {
+  const char *name;
+  uint32_t addr;
+  uint8_t active;
+  uint16_t sp;
+  uint64_t start;
+  uint64_t isr_at_start;  // isr_cycles when it started
+
+  uint32_t calls;
+  uint64_t total;
+  uint64_t max;
+} timed_t;
+
+enum { RX_ISR, PARSE, LOOP, SENSE, TIMED_COUNT };
+
+static timed_t timed[TIMED_COUNT] = {
+  { "rx_isr" }, { "parse" }, { "loop" }, { "sense" }
+};
+
+static uint8_t measuring = 0;
+
+// RX interrupt cycles so far, to take them out of the parse times
+static uint64_t isr_cycles = 0;
+
+// Main loop periods. read_sensor() runs comm_run() between its bursts, so
+// the loop is timed on health_loop(), which only the main loop calls.
+static uint64_t last_loop = 0;
+static uint8_t sensed = 0;
+static uint64_t loop_sense_max = 0;
+
+static uint16_t stack_pointer() {
+  return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+// A function started or returned
+static void timed_begin(timed_t *t, uint16_t sp) {
+  t->active = 1;
+  t->sp = sp;
+  t->start = avr->cycle;
+  t->isr_at_start = isr_cycles;
+
+  if (t == &timed[LOOP]) {
+    if (measuring && last_loop && sensed) {
+      uint64_t period = avr->cycle - last_loop;
+      if (period > loop_sense_max) loop_sense_max = period;
+    }
+    last_loop = avr->cycle;
+    sensed = 0;
+  }
+  if (t == &timed[SENSE]) {
+    sensed = 1;
+  }
+}
+
+static void timed_end(timed_t *t) {
+  uint64_t cycles = avr->cycle - t->start;
+  t->active = 0;
+
+  if (t == &timed[RX_ISR]) {
+    isr_cycles += cycles;
+  } else {
+    cycles -= isr_cycles - t->isr_at_start;
+  }
+
+  if (measuring) {
+    t->calls++;
+    t->total += cycles;
+    if (cycles > t->max) t->max = cycles;
+  }
+}
+
+// Check for functions starting or returning, after each instruction.
+// A function starts when the PC reaches its address, and returns when the
+// stack pointer is back above where it was (its return address popped).
+static void observe() {
+  uint16_t sp = stack_pointer();
+
+  for (int i = 0; i < TIMED_COUNT; i++) {
+    timed_t *t = &timed[i];
+    if (!t->active && avr->pc == t->addr) {
+      timed_begin(t, sp);
+    }
+    else if (t->active && sp > t->sp) {
+      timed_end(t);
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+                              bus
+----------------------------------------------------------------------------*/
+
+// Bytes waiting to be sent to the node
+static uint8_t queue[MAX_QUEUE];
+static int queue_head = 0, queue_len = 0;
+static uint64_t next_byte = 0;  // When the next byte can start
+static uint64_t last_rx_end = 0;  // When the last byte sent finishes
+
+// Bytes from the node
+static int tx_count = 0;
+static uint8_t tx_bytes[256];
+static uint64_t first_tx = 0;
+
+static uint16_t crc = 0xFFFF;
+
+static uint64_t turnaround_max = 0, turnaround_total = 0;
+static uint32_t turnaround_count = 0;
+
+// Same as avr-libc's _crc16_update()
+static uint16_t crc16_update(uint16_t c, uint8_t a) {
+  c ^= a;
+  for (int i = 0; i < 8; i++) {
+    c = (c & 1) ? (c >> 1) ^ 0xA001 : (c >> 1);
+  }
+  return c;
+}
+
+static void queue_byte(uint8_t b) {
+  if (queue_len == MAX_QUEUE) {
+    fprintf(stderr, "perf_harness: too many bytes queued\n");
+    exit(2);
+  }
+  queue[(queue_head + queue_len) % MAX_QUEUE] = b;
+  queue_len++;
+}
+
+static void uart_out_hook(struct avr_irq_t *irq, uint32_t value, void *param) {
+  if (tx_count == 0) {
+    first_tx = avr->cycle;
+  }
+  if (tx_count < (int)sizeof(tx_bytes)) {
+    tx_bytes[tx_count] = value;
+  }
+  tx_count++;
+}
+
+// Run one instruction, and send the next byte when it's time
+static void step() {
+  int state = avr_run(avr);
+  if (state == cpu_Done || state == cpu_Crashed) {
+    fprintf(stderr, "perf_harness: the firmware stopped (state %d) at 0x%04x\n", state, avr->pc);
+    exit(1);
+  }
+  observe();
+
+  if (queue_len && avr->cycle >= next_byte) {
+    avr_raise_irq(uart_in, queue[queue_head]);
+    queue_head = (queue_head + 1) % MAX_QUEUE;
+    queue_len--;
+    next_byte = avr->cycle + BYTE_CYCLES;
+    last_rx_end = next_byte;
+  }
+}
+
+static void run_us(uint32_t us) {
+  uint64_t end = avr->cycle + (uint64_t)us * (F_CPU / 1000000);
+  while (avr->cycle < end) {
+    step();
+  }
+}
+
+/*----------------------------------------------------------------------------
+                              script
+----------------------------------------------------------------------------*/
+
+static char *lines[MAX_LINES];
+static int line_nums[MAX_LINES];
+static int line_count = 0;
+
+static void script_error(int line, const char *msg) {
+  fprintf(stderr, "perf_harness: traffic line %d: %s\n", line_nums[line], msg);
+  exit(2);
+}
+
+static void load_script(const char *path) {
+  char buff[512];
+  int num = 0;
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    perror(path);
+    exit(2);
+  }
+  while (fgets(buff, sizeof(buff), f)) {
+    char *s = buff, *hash = strchr(buff, '#');
+    num++;
+    if (hash) *hash = '\0';
+    while (isspace((unsigned char)*s)) s++;
+    if (!*s) continue;
+
+    if (line_count == MAX_LINES) {
+      fprintf(stderr, "perf_harness: %s is too long\n", path);
+      exit(2);
+    }
+    line_nums[line_count] = num;
+    lines[line_count++] = strdup(s);
+  }
+  fclose(f);
+}
+
+// Send bytes: hex values, or XX*N for N of the same byte
+static void cmd_send(int line, char *args) {
+  char *tok = strtok(args, " \t\r\n");
+  while (tok) {
+    char *star = strchr(tok, '*');
+    int count = (star) ? atoi(star + 1) : 1;
+    uint8_t b = strtoul(tok, 0, 16);
+
+    if (count < 1) script_error(line, "bad repeat count");
+    while (count--) {
+      queue_byte(b);
+      crc = crc16_update(crc, b);
+    }
+    tok = strtok(0, " \t\r\n");
+  }
+}
+
+// Wait for the node to send `count` bytes
+static void cmd_expect(int line, int count, uint32_t timeout_us) {
+  uint64_t deadline;
+
+  // Everything queued goes out first
+  while (queue_len) {
+    step();
+  }
+  while (avr->cycle < last_rx_end) {
+    step();
+  }
+
+  tx_count = 0;
+  deadline = avr->cycle + (uint64_t)timeout_us * (F_CPU / 1000000);
+  while (tx_count < count) {
+    if (avr->cycle > deadline) {
+      script_error(line, "the node didn't answer");
+    }
+    step();
+  }
+
+  // Turnaround to the first byte
+  if (measuring) {
+    uint64_t t = first_tx - last_rx_end;
+    if (t > turnaround_max) turnaround_max = t;
+    turnaround_total += t;
+    turnaround_count++;
+  }
+
+  // Responses are part of the message CRC
+  for (int i = 0; i < count && i < (int)sizeof(tx_bytes); i++) {
+    crc = crc16_update(crc, tx_bytes[i]);
+  }
+}
+
+// Run lines [from, to), returns the line after the block
+static int run_script(int from, int to) {
+  int i = from;
+
+  while (i < to) {
+    char cmd[32];
+    char *args;
+    int a = 0, b = 0;
+
+    if (sscanf(lines[i], "%31s", cmd) != 1) script_error(i, "can't read the command");
+    args = lines[i] + strlen(cmd);
+
+    if (!strcmp(cmd, "som")) {
+      queue_byte(0xFF);
+      queue_byte(0xFF);
+      crc = 0xFFFF;
+    }
+    else if (!strcmp(cmd, "send")) {
+      char *copy = strdup(args);
+      cmd_send(i, copy);
+      free(copy);
+    }
+    else if (!strcmp(cmd, "crc")) {
+      queue_byte(crc >> 8);
+      queue_byte(crc & 0xFF);
+    }
+    else if (!strcmp(cmd, "expect")) {
+      b = 2000;
+      if (sscanf(args, "%d %d", &a, &b) < 1) script_error(i, "expect N [timeout us]");
+      cmd_expect(i, a, b);
+    }
+    else if (!strcmp(cmd, "wait")) {
+      if (sscanf(args, "%d", &a) != 1) script_error(i, "wait US");
+      run_us(a);
+    }
+    else if (!strcmp(cmd, "daisy")) {
+      if (sscanf(args, "%d %d", &a, &b) != 2 || a < 1 || a > 2) script_error(i, "daisy LINE LEVEL");
+      avr_raise_irq(daisy_pins[a - 1], b ? 1 : 0);
+    }
+    else if (!strcmp(cmd, "measure")) {
+      measuring = (strstr(args, "on") != 0);
+    }
+    else if (!strcmp(cmd, "repeat")) {
+      int depth = 1, end = i + 1;
+      if (sscanf(args, "%d", &a) != 1) script_error(i, "repeat N");
+
+      // Find the matching end
+      for (; end < to; end++) {
+        if (!strncmp(lines[end], "repeat", 6)) depth++;
+        if (!strncmp(lines[end], "end", 3) && --depth == 0) break;
+      }
+      if (end == to) script_error(i, "repeat without an end");
+
+      while (a--) {
+        run_script(i + 1, end);
+      }
+      i = end;
+    }
+    else {
+      script_error(i, "unknown command");
+    }
+    i++;
+  }
+  return i;
+}
+
+/*----------------------------------------------------------------------------
+                              program
+----------------------------------------------------------------------------*/
+
+int main(int argc, char **argv) {
+  elf_firmware_t firmware;
+  uint32_t flags = 0;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: perf_harness node.elf traffic.txt name=0xaddress...\n");
+    return 2;
+  }
+
+  for (int i = 3; i < argc; i++) {
+    char *eq = strchr(argv[i], '=');
+    int found = 0;
+    for (int t = 0; eq && t < TIMED_COUNT; t++) {
+      if (!strncmp(argv[i], timed[t].name, eq - argv[i]) && strlen(timed[t].name) == (size_t)(eq - argv[i])) {
+        timed[t].addr = strtoul(eq + 1, 0, 16);
+        found = 1;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "perf_harness: unknown function %s\n", argv[i]);
+      return 2;
+    }
+  }
+  for (int t = 0; t < TIMED_COUNT; t++) {
+    if (!timed[t].addr) {
+      fprintf(stderr, "perf_harness: no address for %s (is the symbol missing?)\n", timed[t].name);
+      return 2;
+    }
+  }
+
+  load_script(argv[2]);
+
+  // Load the firmware
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[1], &firmware)) {
+    fprintf(stderr, "perf_harness: can't read %s\n", argv[1]);
+    return 2;
+  }
+  strcpy(firmware.mmcu, MCU);
+  firmware.frequency = F_CPU;
+
+  avr = avr_make_mcu_by_name(MCU);
+  if (!avr) {
+    fprintf(stderr, "perf_harness: simavr doesn't know the %s\n", MCU);
+    return 2;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = F_CPU;
+
+  // UART: bytes from the node go to us, not stdout
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+  uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+  avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+                          uart_out_hook, 0);
+
+  // Daisy chain lines (PC3, PC4), idle high
+  daisy_pins[0] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 3);
+  daisy_pins[1] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 4);
+  avr_raise_irq(daisy_pins[0], 1);
+  avr_raise_irq(daisy_pins[1], 1);
+
+  run_script(0, line_count);
+
+  if (!timed[RX_ISR].calls || !timed[PARSE].calls) {
+    fprintf(stderr, "perf_harness: no bytes were received while measuring\n");
+    return 1;
+  }
+  if (!loop_sense_max) {
+    fprintf(stderr, "perf_harness: read_sensor() never ran while measuring (inlined?)\n");
+    return 1;
+  }
+  if (!turnaround_count) {
+    fprintf(stderr, "perf_harness: no responses while measuring\n");
+    return 1;
+  }
+
+  printf("rx_isr_cycles_max %llu\n", (unsigned long long)timed[RX_ISR].max);
+  printf("rx_isr_cycles_avg %llu\n", (unsigned long long)(timed[RX_ISR].total / timed[RX_ISR].calls));
+  printf("parse_cycles_per_byte %llu\n", (unsigned long long)(timed[PARSE].total / timed[PARSE].calls));
+  printf("parse_cycles_max %llu\n", (unsigned long long)timed[PARSE].max);
+  printf("loop_sense_cycles_max %llu\n", (unsigned long long)loop_sense_max);
+  printf("turnaround_us_max %.1f\n", turnaround_max / (F_CPU / 1e6));
+  printf("turnaround_us_avg %.1f\n", (double)turnaround_total / turnaround_count / (F_CPU / 1e6));
+  return 0;
+}
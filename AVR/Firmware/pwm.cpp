@@ -0,0 +1,124 @@
+/*******************************************************************************
+* PWM
+*
+* Drives the RGB LEDs from timers 0 and 1.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "pwm.h"
+
+// Timer 1 top value in 12-bit mode
+#define PWM_12BIT_TOP 0x0FFF
+
+static uint8_t resolution = PWM_8BIT;
+
+// Timer 0 dithering: the 8-bit base value, and the 4 fraction bits (in the upper nibble)
+static volatile uint8_t red_base, red_frac, red_acc;
+static volatile uint8_t green_base, green_frac, green_acc;
+
+// Red LED PWM settings.
+void red_pwm_init() {
+  DDRD   |= (1 << PD6);
+  TCCR0A |= (1 << COM0A1); // Compare output mode: PWM
+  TCCR0A |= (1 << WGM00);  // Waveform generator: PWM phase correct
+  TCCR0B |= (1 << CS00);   // No prescaler
+}
+
+// Green LED PWM settings.
+void green_pwm_init() {
+  DDRD   |= (1 << PD5);
+  TCCR0A |= (1 << COM0B1); // Compare output mode: PWM
+  TCCR0A |= (1 << WGM00);  // Waveform generator: PWM phase correct
+  TCCR0B |= (1 << CS00);   // No prescaler
+}
+
+// Blue LED PWM settings.
+void blue_pwm_init() {
+  DDRB   |= (1 << PB1); 
+  TCCR1A |= (1 << COM1A1); // Compare output mode: PWM
+  TCCR1A |= (1 << WGM10);  // PWM, Phase Correct, 8-bit
+  TCCR1B |= (1 << CS10);   // No prescaler 
+}
+
+// Setup all three LEDs
+void pwm_init() {
+  red_pwm_init();
+  green_pwm_init();
+  blue_pwm_init();
+}
+
+void pwm_set_resolution(uint8_t mode) {
+  if (mode == resolution) return;
+  resolution = mode;
+
+  if (mode == PWM_12BIT) {
+    // Timer 1: PWM, Phase Correct, TOP = ICR1
+    TCCR1A = (1 << COM1A1) | (1 << WGM11);
+    TCCR1B = (1 << WGM13) | (1 << CS10);
+    ICR1   = PWM_12BIT_TOP;
+    OCR1A  = (uint16_t)OCR1A << 4;
+
+    // Timer 0 only dithers once a value has a fraction (see pwm_rgb16())
+    red_base = OCR0A;
+    green_base = OCR0B;
+    red_frac = green_frac = 0;
+  }
+  else {
+    TIMSK0 &= ~(1 << TOIE0);
+    OCR0A = red_base;
+    OCR0B = green_base;
+
+    // Timer 1: PWM, Phase Correct, 8-bit
+    TCCR1A = (1 << COM1A1) | (1 << WGM10);
+    TCCR1B = (1 << CS10);
+    OCR1A  = OCR1A >> 4;
+  }
+}
+
+uint8_t pwm_get_resolution() {
+  return resolution;
+}
+
+void pwm_rgb16(uint16_t red, uint16_t green, uint16_t blue) {
+  if (resolution == PWM_12BIT) {
+    uint8_t sreg = SREG;
+    cli();
+    red_base   = red >> 8;
+    red_frac   = red & 0xF0;
+    green_base = green >> 8;
+    green_frac = green & 0xF0;
+
+    // The dithering interrupt fires every 510 cycles, so only run it when it's needed
+    if (red_frac | green_frac) {
+      TIMSK0 |= (1 << TOIE0);
+    } else {
+      TIMSK0 &= ~(1 << TOIE0);
+      OCR0A = red_base;
+      OCR0B = green_base;
+    }
+    SREG = sreg;
+
+    OCR1A = blue >> 4;
+  }
+  else {
+    red_pwm(red >> 8);
+    green_pwm(green >> 8);
+    blue_pwm(blue >> 8);
+  }
+}
+
+// Timer 0 reached bottom: pick the next value for each channel so that,
+// averaged over 16 PWM cycles, it lands on the fractional value.
+ISR(TIMER0_OVF_vect) {
+  uint8_t acc;
+
+  acc = red_acc + red_frac;
+  OCR0A = (acc < red_acc && red_base < 0xFF) ? red_base + 1 : red_base;
+  red_acc = acc;
+
+  acc = green_acc + green_frac;
+  OCR0B = (acc < green_acc && green_base < 0xFF) ? green_base + 1 : green_base;
+  green_acc = acc;
+}
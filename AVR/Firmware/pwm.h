@@ -1,40 +1,44 @@
 /**
  * Provides helper methods to setup use the PWM lines for the RGB LEDs.
+ *
+ * There are two output resolutions:
+ *  + PWM_8BIT:  Red and green on 8-bit Timer 0, blue on Timer 1 as 8-bit.
+ *  + PWM_12BIT: Blue runs from 16-bit Timer 1 with a 12-bit top. Red and green stay
+ *               on Timer 0, but an overflow interrupt dithers between the two
+ *               nearest 8-bit values to add 4 more bits. The interrupt fires every
+ *               510 cycles, so it only runs while red or green has a fraction.
  */
 
 #ifndef PWM_H
 #define PWM_H
 
+#include <avr/io.h>
+
+// Output resolution modes
+#define PWM_8BIT  0
+#define PWM_12BIT 1
+
 // Red LED PWM settings.
-void red_pwm_init() {
-  DDRD   |= (1 << PD6);
-  TCCR0A |= (1 << COM0A1); // Compare output mode: PWM
-  TCCR0A |= (1 << WGM00);  // Waveform generator: PWM phase correct
-  TCCR0B |= (1 << CS00);   // No prescaler
-}
+void red_pwm_init();
 
 // Green LED PWM settings.
-void green_pwm_init() {
-  DDRD   |= (1 << PD5);
-  TCCR0A |= (1 << COM0B1); // Compare output mode: PWM
-  TCCR0A |= (1 << WGM00);  // Waveform generator: PWM phase correct
-  TCCR0B |= (1 << CS00);   // No prescaler
-}
+void green_pwm_init();
 
 // Blue LED PWM settings.
-void blue_pwm_init() {
-  DDRB   |= (1 << PB1); 
-  TCCR1A |= (1 << COM1A1); // Compare output mode: PWM
-  TCCR1A |= (1 << WGM10);  // PWM, Phase Correct, 8-bit
-  TCCR1B |= (1 << CS10);   // No prescaler 
-}
+void blue_pwm_init();
 
 // Setup all three LEDs
-void pwm_init() {
-  red_pwm_init();
-  green_pwm_init();
-  blue_pwm_init();
-}
+void pwm_init();
+
+// Switch between PWM_8BIT and PWM_12BIT output
+void pwm_set_resolution(uint8_t mode);
+
+// Get the current output resolution
+uint8_t pwm_get_resolution();
+
+// Set all three LEDs from 16-bit values.
+// Only the top 12 bits are used in PWM_12BIT mode, and the top 8 bits in PWM_8BIT mode.
+void pwm_rgb16(uint16_t red, uint16_t green, uint16_t blue);
 
 // Set the red PWM value
 inline void red_pwm(uint8_t value) {
@@ -0,0 +1,65 @@
+/*******************************************************************************
+* Scenes
+*
+* Preset colors that are uploaded ahead of time and recalled by index.
+******************************************************************************/
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "scenes.h"
+
+static scene_t scenes[SCENE_COUNT];
+
+// Scene waiting to be recalled
+static uint8_t pending = SCENE_NONE;
+static uint16_t pending_time;
+
+void scene_set(uint8_t index, uint8_t *data) {
+  if (index >= SCENE_COUNT) return;
+
+  scenes[index].rgb[0] = data[0];
+  scenes[index].rgb[1] = data[1];
+  scenes[index].rgb[2] = data[2];
+  scenes[index].fade = (data[3] << 8) | data[4];
+}
+
+scene_t* scene_get(uint8_t index) {
+  if (index >= SCENE_COUNT) return 0;
+  return &scenes[index];
+}
+
+void scene_load(void *eeprom_addr) {
+  uint8_t i;
+  eeprom_read_block(scenes, eeprom_addr, sizeof(scenes));
+
+  // Unprogrammed EEPROM scenes are black
+  for (i = 0; i < SCENE_COUNT; i++) {
+    if (scenes[i].fade == 0xFFFF) {
+      scenes[i].rgb[0] = 0;
+      scenes[i].rgb[1] = 0;
+      scenes[i].rgb[2] = 0;
+      scenes[i].fade = 0;
+    }
+  }
+}
+
+void scene_save(void *eeprom_addr) {
+  eeprom_update_block(scenes, eeprom_addr, sizeof(scenes));
+}
+
+void scene_recall(uint8_t index, uint16_t delay, uint16_t now) {
+  if (index >= SCENE_COUNT) return;
+  pending = index;
+  pending_time = now + delay;
+}
+
+uint8_t scene_due(uint16_t now) {
+  uint8_t index = pending;
+
+  if (index == SCENE_NONE || (int16_t)(now - pending_time) < 0) {
+    return SCENE_NONE;
+  }
+  pending = SCENE_NONE;
+  return index;
+}
@@ -0,0 +1,43 @@
+/**
+ * Scenes stored on the node, so the master can change the whole floor
+ * to a preset look with one short broadcast message.
+ */
+
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <stdint.h>
+
+// How many scenes each node can hold
+#ifndef SCENE_COUNT
+#define SCENE_COUNT 8
+#endif
+
+// No scene is waiting to be recalled
+#define SCENE_NONE 0xFF
+
+// Bytes each scene takes up in the EEPROM
+#define SCENE_SIZE sizeof(scene_t)
+
+typedef struct {
+  uint8_t  rgb[3];
+  uint16_t fade;   // Milliseconds to fade into this scene
+} scene_t;
+
+// Set a scene from a message: [r, g, b, fade (ms, big endian)]
+void scene_set(uint8_t index, uint8_t *data);
+
+// Get a scene (or 0 for an invalid index)
+scene_t* scene_get(uint8_t index);
+
+// Load all scenes from, or save them to, the EEPROM
+void scene_load(void *eeprom_addr);
+void scene_save(void *eeprom_addr);
+
+// Recall a scene `delay` milliseconds from now
+void scene_recall(uint8_t index, uint16_t delay, uint16_t now);
+
+// Returns the scene index that is due to be displayed now, or SCENE_NONE
+uint8_t scene_due(uint16_t now);
+
+#endif
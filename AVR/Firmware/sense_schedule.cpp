@@ -0,0 +1,53 @@
+/*******************************************************************************
+* Sense Schedule
+*
+* Times self-run touch sensor measurements, either at a fixed interval
+* or in this node's slot after a broadcast sync.
+******************************************************************************/
+
+#include "sense_schedule.h"
+
+static uint8_t slot = SENSE_SLOT_AUTO;
+static uint16_t period = 0;    // Milliseconds between measurements (0 = off)
+static uint16_t next_time = 0; // When to measure next
+
+void sense_schedule_set_slot(uint8_t s) {
+  slot = s;
+}
+
+uint8_t sense_schedule_get_slot() {
+  return slot;
+}
+
+void sense_schedule_interval(uint16_t now, uint8_t interval) {
+  period = interval;
+  next_time = now + interval;
+}
+
+void sense_schedule_sync(uint16_t now, uint8_t slot_width, uint8_t num_slots, uint16_t address) {
+  uint8_t s;
+
+  period = slot_width * num_slots;
+  if (period == 0) return;
+
+  // Neighbors on the bus alternate slots, when no slot has been assigned
+  if (slot == SENSE_SLOT_AUTO) {
+    s = (address > 0) ? (address - 1) % num_slots : 0;
+  } else {
+    s = slot % num_slots;
+  }
+  next_time = now + (s * slot_width);
+}
+
+uint8_t sense_schedule_due(uint16_t now) {
+  if (period == 0 || (int16_t)(now - next_time) < 0) {
+    return 0;
+  }
+
+  // Stay on the slot grid, skipping any cycles we were too busy to make
+  do {
+    next_time += period;
+  } while ((int16_t)(now - next_time) >= 0);
+
+  return 1;
+}
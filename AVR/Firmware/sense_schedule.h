@@ -0,0 +1,35 @@
+/**
+ * Decides when the node should check its touch sensor on its own.
+ *
+ * Neighboring electrodes couple into each other when they're measured at
+ * the same time. So, after a broadcast sync, each node waits for its own slot
+ * before measuring. Nodes next to each other are given different slots, so
+ * they never measure together, but every node still measures once a cycle.
+ * The cycle repeats on its own until the next sync.
+ */
+
+#ifndef SENSE_SCHEDULE_H
+#define SENSE_SCHEDULE_H
+
+#include <stdint.h>
+
+// Slot value that means: pick the slot from the node address
+#define SENSE_SLOT_AUTO 0xFF
+
+// Assign this node to a slot (or SENSE_SLOT_AUTO)
+void sense_schedule_set_slot(uint8_t slot);
+
+// Get the assigned slot
+uint8_t sense_schedule_get_slot();
+
+// Measure every `interval` milliseconds, without any slots (0 = stop)
+void sense_schedule_interval(uint16_t now, uint8_t interval);
+
+// Start a synced cycle of `num_slots` slots, each `slot_width` milliseconds long (0 slots = stop).
+// `address` picks the slot when the node hasn't been assigned one.
+void sense_schedule_sync(uint16_t now, uint8_t slot_width, uint8_t num_slots, uint16_t address);
+
+// Returns 1 if it's time to measure (and moves on to the next cycle)
+uint8_t sense_schedule_due(uint16_t now);
+
+#endif
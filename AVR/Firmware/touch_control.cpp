@@ -11,6 +11,19 @@
 #include "touch_api.h"
 #include "touch.h"
 #include "touch_control.h"
+#include "clock.h"
+#include "health.h"
+#include "trace.h"
+
+/*----------------------------------------------------------------------------
+                                constants
+----------------------------------------------------------------------------*/
+
+// The smallest threshold calibration will choose
+#define CAL_MIN_THRESHOLD 4
+
+// A touch delta must be at least this much above the noise floor to be usable
+#define CAL_MIN_MARGIN 4
 
 /*----------------------------------------------------------------------------
                                 extern variables
@@ -23,19 +36,47 @@ extern qt_touch_lib_config_data_t qt_config_data;
 /* touch output - measurement data */
 extern qt_touch_lib_measure_data_t qt_measure_data;
 
+/*----------------------------------------------------------------------------
+                                global variables
+----------------------------------------------------------------------------*/
+
+// Calibration state
+static uint8_t cal_phase = TOUCH_CAL_OFF;
+static uint16_t cal_noise = 0;
+static uint16_t cal_peak = 0;
+
+// Acquisition profile and stats
+static uint8_t profile = TOUCH_PROFILE_ROBUST;
+static touch_stats_t stats;
+
+// Stats already sent to the master, kept until it acknowledges them
+static touch_stats_t reported;
+static uint8_t reported_seq = 0;
+static uint16_t read_start = 0;
+static uint8_t read_bursts = 0;
+
 /*============================================================================
  * Initialize the QTouch library
  *============================================================================*/
 void touch_init( uint8_t detect_threshold ) {
+  touch_init(detect_threshold, HYST_6_25);
+}
+void touch_init( uint8_t detect_threshold, uint8_t hysteresis ) {
+  if (hysteresis > HYST_6_25) {
+    hysteresis = HYST_6_25;
+  }
+
+  /* Clear any sensors enabled by a previous call, so they aren't added twice */
+  qt_reset_sensing();
 
   /* Configure the Sensors as keys or Keys With Rotor/Sliders in this function */
-  config_sensors(detect_threshold);
+  config_sensors(detect_threshold, hysteresis);
 
   /* initialise touch sensing */
   qt_init_sensing();
 
   /*  Set the parameters like recalibration threshold, Max_On_Duration etc in this function by the user */
-  qt_set_parameters();
+  qt_set_parameters(profile);
 }
 
 
@@ -59,7 +100,7 @@ uint8_t touch_measure(uint8_t sensor_num, uint16_t current_time, uint8_t max_mea
   uint8_t measure_count = 0;
 
   do {
-    status_flag = qt_measure_sensors( current_time );
+    status_flag = touch_burst( current_time );
     burst_flag = status_flag & QTLIB_BURST_AGAIN;
     measure_count++;
   } while (burst_flag && measure_count < max_measurements);
@@ -74,24 +115,222 @@ uint8_t touch_measure(uint8_t sensor_num, uint16_t current_time) {
 }
 
 
+/*============================================================================
+ * Run a single burst and keep track of how long it took.
+ *
+ * Pull-ups need to be disabled before calling this.
+ *============================================================================*/
+uint16_t touch_burst(uint16_t current_time) {
+  uint16_t start, burst_us, status;
+
+  start = micros();
+  if (read_bursts == 0) {
+    read_start = start;
+  }
+
+  TRACE_BEGIN(SENSE);
+  status = qt_measure_sensors( current_time );
+  TRACE_END(SENSE);
+
+  burst_us = micros() - start;
+  stats.bursts++;
+  health_touch_burst();
+  read_bursts++;
+  if (burst_us > stats.max_burst_us) {
+    stats.max_burst_us = burst_us;
+  }
+
+  // Acquisition complete
+  if (!(status & QTLIB_BURST_AGAIN)) {
+    stats.reads++;
+    stats.last_read_us = micros() - read_start;
+    stats.last_bursts = read_bursts;
+
+    if (stats.last_read_us > stats.max_read_us) {
+      stats.max_read_us = stats.last_read_us;
+    }
+    if (read_bursts > stats.max_bursts) {
+      stats.max_bursts = read_bursts;
+    }
+    read_bursts = 0;
+  }
+
+  return status;
+}
+
+/*============================================================================
+ * Change the detection profile.
+ *   + TOUCH_PROFILE_ROBUST: Needs several agreeing bursts to detect a touch.
+ *                           Slower, but rides out electrical noise.
+ *   + TOUCH_PROFILE_FAST:   Detects on the first burst, for the lowest latency.
+ *============================================================================*/
+void touch_set_profile(uint8_t p) {
+  if (p > TOUCH_PROFILE_FAST) return;
+  profile = p;
+  qt_set_parameters(profile);
+}
+
+uint8_t touch_get_profile() {
+  return profile;
+}
+
+touch_stats_t* touch_get_stats() {
+  return &stats;
+}
+
+void touch_reset_stats() {
+  stats.reads = 0;
+  stats.bursts = 0;
+  stats.max_read_us = 0;
+  stats.max_burst_us = 0;
+  stats.max_bursts = 0;
+}
+
+touch_stats_t* touch_report_stats(uint8_t *seq) {
+  reported.reads += stats.reads;
+  reported.bursts += stats.bursts;
+  reported.last_read_us = stats.last_read_us;
+  reported.last_bursts = stats.last_bursts;
+  if (stats.max_read_us > reported.max_read_us) {
+    reported.max_read_us = stats.max_read_us;
+  }
+  if (stats.max_burst_us > reported.max_burst_us) {
+    reported.max_burst_us = stats.max_burst_us;
+  }
+  if (stats.max_bursts > reported.max_bursts) {
+    reported.max_bursts = stats.max_bursts;
+  }
+  touch_reset_stats();
+
+  reported_seq = (reported_seq == 0xFF) ? 1 : reported_seq + 1;
+  *seq = reported_seq;
+  return &reported;
+}
+
+void touch_ack_stats(uint8_t seq) {
+  if (seq == 0 || seq != reported_seq) return;
+
+  reported.reads = 0;
+  reported.bursts = 0;
+  reported.max_read_us = 0;
+  reported.max_burst_us = 0;
+  reported.max_bursts = 0;
+}
+
+/*============================================================================
+ * Start a calibration phase.
+ *   + TOUCH_CAL_NOISE: Reset the stats and record the idle noise floor.
+ *                      Nobody should be standing on the node.
+ *   + TOUCH_CAL_TOUCH: Record the peak delta while someone stands on the node.
+ *   + TOUCH_CAL_OFF:   Stop sampling.
+ *============================================================================*/
+void touch_calibrate_start(uint8_t phase) {
+  if (phase == TOUCH_CAL_NOISE) {
+    cal_noise = 0;
+    cal_peak = 0;
+  }
+  cal_phase = phase;
+}
+
+uint8_t touch_calibrating() {
+  return cal_phase != TOUCH_CAL_OFF;
+}
+
+/*============================================================================
+ * Add the delta from the last measurement to the calibration stats.
+ *============================================================================*/
+void touch_calibrate_sample() {
+  int16_t delta = qt_get_sensor_delta(0);
+
+  if (cal_phase == TOUCH_CAL_NOISE) {
+    if (delta < 0) {
+      delta = -delta;
+    }
+    if ((uint16_t)delta > cal_noise) {
+      cal_noise = delta;
+    }
+  }
+  else if (cal_phase == TOUCH_CAL_TOUCH) {
+    if (delta > 0 && (uint16_t)delta > cal_peak) {
+      cal_peak = delta;
+    }
+  }
+}
+
+/*============================================================================
+ * Finish calibrating and pick the new detection settings.
+ *
+ * The threshold is set halfway between the noise floor and the touch peak.
+ * Then the largest hysteresis is chosen that still releases above the noise floor.
+ *
+ * Returns 0, and leaves the values alone, if no clear touch was sampled.
+ *============================================================================*/
+uint8_t touch_calibrate_finish(uint8_t *threshold, uint8_t *hysteresis) {
+  uint16_t thresh;
+  uint8_t hyst;
+
+  cal_phase = TOUCH_CAL_OFF;
+
+  if (cal_peak < cal_noise + CAL_MIN_MARGIN) {
+    return 0;
+  }
+
+  thresh = cal_noise + ((cal_peak - cal_noise) / 2);
+  if (thresh < CAL_MIN_THRESHOLD) {
+    thresh = CAL_MIN_THRESHOLD;
+  }
+  else if (thresh > 0xFF) {
+    thresh = 0xFF;
+  }
+
+  // HYST_50 releases at 1/2 the threshold, HYST_25 at 3/4, and so on
+  for (hyst = HYST_50; hyst < HYST_6_25; hyst++) {
+    if (thresh - (thresh >> (hyst + 1)) > cal_noise) {
+      break;
+    }
+  }
+
+  *threshold = thresh;
+  *hysteresis = hyst;
+  return 1;
+}
+
+uint8_t touch_calibrate_noise() {
+  return (cal_noise > 0xFF) ? 0xFF : cal_noise;
+}
+
+uint8_t touch_calibrate_peak() {
+  return (cal_peak > 0xFF) ? 0xFF : cal_peak;
+}
+
 /*============================================================================
  * Set the QTouch detection parameters and threshold values.
  *===========================================================================*/
-static void qt_set_parameters() {
-  qt_config_data.qt_di              = 3; // how many positive sequential aquisitions to represent a touch.
-  qt_config_data.qt_neg_drift_rate  = 20;
-  qt_config_data.qt_pos_drift_rate  = 5;
+static void qt_set_parameters(uint8_t profile) {
   qt_config_data.qt_max_on_duration = 25; // 5 seconds
-  qt_config_data.qt_drift_hold_time = 20;
   qt_config_data.qt_recal_threshold = RECAL_12_5;
-  qt_config_data.qt_pos_recal_delay = 3;
+
+  if (profile == TOUCH_PROFILE_FAST) {
+    qt_config_data.qt_di              = 1; // detect on the first positive aquisition
+    qt_config_data.qt_neg_drift_rate  = 10;
+    qt_config_data.qt_pos_drift_rate  = 5;
+    qt_config_data.qt_drift_hold_time = 10;
+    qt_config_data.qt_pos_recal_delay = 2;
+  }
+  else {
+    qt_config_data.qt_di              = 3; // how many positive sequential aquisitions to represent a touch.
+    qt_config_data.qt_neg_drift_rate  = 20;
+    qt_config_data.qt_pos_drift_rate  = 5;
+    qt_config_data.qt_drift_hold_time = 20;
+    qt_config_data.qt_pos_recal_delay = 3;
+  }
 }
 
 /*============================================================================
  * Setup all the sensors
  *============================================================================*/
-static void config_sensors(uint8_t detect_threshold) {
-  qt_enable_key( CHANNEL_0, NO_AKS_GROUP, detect_threshold, HYST_6_25 );
+static void config_sensors(uint8_t detect_threshold, uint8_t hysteresis) {
+  qt_enable_key( CHANNEL_0, NO_AKS_GROUP, detect_threshold, (hysteresis_t)hysteresis );
 }
 
 
@@ -5,18 +5,79 @@
 // Get the state of a single sensor
 #define GET_SENSOR_STATE(SENSOR_NUMBER) qt_measure_data.qt_touch_status.sensor_states[(SENSOR_NUMBER/8)] & (1 << (SENSOR_NUMBER % 8))
 
+// Detection profiles (see touch_set_profile)
+#define TOUCH_PROFILE_ROBUST 0
+#define TOUCH_PROFILE_FAST   1
+
+// Acquisition timing stats
+typedef struct {
+  uint16_t reads;        // Completed acquisitions (bursts until the library stops asking for more)
+  uint16_t bursts;       // Calls to qt_measure_sensors
+  uint16_t last_read_us; // Duration of the last acquisition
+  uint16_t max_read_us;  // Longest acquisition
+  uint16_t max_burst_us; // Longest single burst
+  uint8_t  last_bursts;  // Bursts it took for the last acquisition
+  uint8_t  max_bursts;   // Most bursts it took for one acquisition
+} touch_stats_t;
+
+// Calibration phases (see touch_calibrate_start)
+#define TOUCH_CAL_OFF   0
+#define TOUCH_CAL_NOISE 1
+#define TOUCH_CAL_TOUCH 2
+
 // Initialize the touch sensors
 void touch_init( uint8_t detect_threshold );
+void touch_init( uint8_t detect_threshold, uint8_t hysteresis );
+
+// Start sampling the idle noise floor or the touch delta
+void touch_calibrate_start(uint8_t phase);
+
+// Is a calibration phase currently running
+uint8_t touch_calibrating();
+
+// Record the sensor delta from the last measurement into the calibration stats
+void touch_calibrate_sample();
+
+// End calibration and choose a threshold and hysteresis from the sampled values.
+// Returns 1 if the samples were good enough to choose new values.
+uint8_t touch_calibrate_finish(uint8_t *threshold, uint8_t *hysteresis);
+
+// The highest idle delta and touch delta seen during the last calibration
+uint8_t touch_calibrate_noise();
+uint8_t touch_calibrate_peak();
+
+// Run one burst on all sensors and return the QTouch status flags.
+// Keep calling it while QTLIB_BURST_AGAIN is set to finish the acquisition.
+uint16_t touch_burst(uint16_t current_time);
+
+// Switch between TOUCH_PROFILE_ROBUST and TOUCH_PROFILE_FAST
+void touch_set_profile(uint8_t profile);
+uint8_t touch_get_profile();
+
+// Get the acquisition timing stats
+touch_stats_t* touch_get_stats();
+
+// Reset the stats (the counts and the max values)
+void touch_reset_stats();
+
+// Stats for the master: the current window is added to anything it hasn't
+// acknowledged yet, so a lost response is included in the next one.
+// `seq` is set to this report's sequence number (never 0).
+touch_stats_t* touch_report_stats(uint8_t *seq);
+
+// The master received the report with this sequence number, so start the
+// next window from zero. Anything else (an older report, or 0) is ignored.
+void touch_ack_stats(uint8_t seq);
 
 // Make a touch measurement 
 uint8_t touch_measure(uint8_t sensor_num, uint16_t current_time);
 uint8_t touch_measure(uint8_t sensor_num, uint16_t current_time, uint8_t max_measurements);
 
 // Assign the parameters values to global configuration parameter structure
-static void qt_set_parameters( void );
+static void qt_set_parameters( uint8_t profile );
 
 //  Configure the sensors
-static void config_sensors(uint8_t detect_threshold);
+static void config_sensors(uint8_t detect_threshold, uint8_t hysteresis);
 
 extern "C" uint16_t qt_measure_sensors( uint16_t current_time_ms );
 
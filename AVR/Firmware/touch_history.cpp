@@ -0,0 +1,90 @@
+/*******************************************************************************
+* Touch History
+*
+* Ring buffer of timestamped touch sensor transitions.
+******************************************************************************/
+
+#include "touch_history.h"
+
+#define HISTORY_MASK (TOUCH_HISTORY_LEN - 1)
+#define STATE_BIT 0x8000
+#define TIME_MASK 0x7FFF
+
+static uint16_t history[TOUCH_HISTORY_LEN];
+static uint8_t head = 0;
+static uint8_t tail = 0;
+
+// Transitions dropped because the history was full, and how many of those
+// the last response reported
+static uint8_t dropped = 0;
+static uint8_t dropped_sent = 0;
+
+// The last response: its sequence number, and how many transitions (from the
+// tail) it had, which are removed when it's acknowledged
+static uint8_t seq = 0;
+static uint8_t sent = 0;
+
+/**
+ * Add a transition to the history.
+ * If the history is full the oldest transition is dropped.
+ */
+void touch_history_push(uint8_t state, uint16_t time) {
+  uint8_t next = (head + 1) & HISTORY_MASK;
+
+  if (next == tail) {
+    tail = (tail + 1) & HISTORY_MASK;
+    if (sent) sent--;
+    if (dropped < 0xFF) dropped++;
+  }
+
+  history[head] = (time & TIME_MASK) | (state ? STATE_BIT : 0);
+  head = next;
+}
+
+uint8_t touch_history_count() {
+  return (head - tail) & HISTORY_MASK;
+}
+
+/**
+ * Copy the oldest transitions into a response buffer.
+ */
+uint8_t touch_history_drain(uint8_t *buff, uint8_t len, uint16_t now) {
+  uint8_t i = TOUCH_HISTORY_HEADER_LEN,
+          pos = tail,
+          count = 0;
+
+  if (len < TOUCH_HISTORY_HEADER_LEN) {
+    return 0;
+  }
+
+  while (pos != head && i + 2 <= len) {
+    buff[i++] = history[pos] >> 8;
+    buff[i++] = history[pos] & 0xFF;
+    pos = (pos + 1) & HISTORY_MASK;
+    count++;
+  }
+
+  seq = (seq == 0xFF) ? 1 : seq + 1;
+  sent = count;
+  dropped_sent = dropped;
+
+  buff[0] = count | (dropped ? 0x80 : 0);
+  buff[1] = now >> 8;
+  buff[2] = now & 0xFF;
+  buff[3] = seq;
+
+  // Zero any unused space
+  while (i < len) {
+    buff[i++] = 0;
+  }
+  return count;
+}
+
+void touch_history_ack(uint8_t ack_seq) {
+  if (ack_seq == 0 || ack_seq != seq) return;
+
+  tail = (tail + sent) & HISTORY_MASK;
+  dropped -= dropped_sent;
+  sent = 0;
+  dropped_sent = 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * Keeps a ring buffer of touch sensor transitions, stamped with the
+ * millisecond clock, so the master can poll rarely and still reconstruct
+ * exactly when each press and release happened.
+ *
+ * Transitions stay in the history until the master acknowledges the response
+ * they were sent in, so a response lost on the bus is simply sent again.
+ */
+
+#ifndef TOUCH_HISTORY_H
+#define TOUCH_HISTORY_H
+
+#include <stdint.h>
+
+// Number of transitions kept (must be a power of 2)
+#ifndef TOUCH_HISTORY_LEN
+#define TOUCH_HISTORY_LEN 16
+#endif
+
+// Size of the header at the start of a drained buffer
+#define TOUCH_HISTORY_HEADER_LEN 4
+
+// Record a sensor transition
+void touch_history_push(uint8_t state, uint16_t time);
+
+// Number of transitions that haven't been acknowledged yet
+uint8_t touch_history_count();
+
+// Copy as many of the oldest transitions as fit into `buff`. They stay in the
+// history, and are sent again, until touch_history_ack() with this response's
+// sequence number.
+//
+// Format:
+//   [0]    Number of transitions that follow. Bit 7 is set if transitions
+//          were dropped because the history was full.
+//   [1..2] The current time (ms, big endian) to align the timestamps to.
+//   [3]    Sequence number of this response (never 0).
+//   [4..]  2 bytes per transition (big endian): bit 15 is the new sensor state,
+//          bits 0-14 are the lower 15 bits of the time it happened.
+//
+// Returns the number of transitions copied.
+uint8_t touch_history_drain(uint8_t *buff, uint8_t len, uint16_t now);
+
+// The master received the response with this sequence number, so remove the
+// transitions it had. Anything else (an older response, or 0) is ignored.
+void touch_history_ack(uint8_t seq);
+
+#endif
@@ -0,0 +1,109 @@
+/*******************************************************************************
+* Trace
+*
+* Ring buffer of timestamped trace events. Events can be logged from
+* interrupts, so the ring is only touched with interrupts off.
+* Only built with TRACE defined (`make TRACE=1`).
+******************************************************************************/
+
+#ifdef TRACE
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "trace.h"
+
+#define TRACE_MASK (TRACE_LEN - 1)
+
+// Millisecond count from the clock
+extern volatile uint16_t current_time;
+
+static uint8_t events[TRACE_LEN];
+static uint16_t stamps[TRACE_LEN];
+static uint8_t head = 0;
+static uint8_t tail = 0;
+static uint8_t log_mask = (uint8_t)~(1 << TRACE_RX_ISR);
+
+// Events dropped because the ring was full, and how many of those the last
+// response reported
+static uint8_t dropped = 0;
+static uint8_t dropped_sent = 0;
+
+// The last response: its sequence number, and how many events (from the
+// tail) it had, which are removed when it's acknowledged
+static uint8_t seq = 0;
+static uint8_t sent = 0;
+
+void trace_init() {
+  TRACE_DDR |= (1 << TRACE_PIN_RX_ISR) | (1 << TRACE_PIN_PARSE) |
+               (1 << TRACE_PIN_RESPONSE) | (1 << TRACE_PIN_SENSE);
+}
+
+void trace_set_mask(uint8_t mask) {
+  log_mask = mask;
+}
+
+/**
+ * Add an event to the ring.
+ * If the ring is full the oldest event is dropped.
+ */
+void trace_log(uint8_t event) {
+  if (!(log_mask & (1 << (event & 0x07)))) return;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t next = (head + 1) & TRACE_MASK;
+
+    if (next == tail) {
+      tail = (tail + 1) & TRACE_MASK;
+      if (sent) sent--;
+      if (dropped < 0xFF) dropped++;
+    }
+
+    events[head] = event;
+    stamps[head] = ((uint8_t)current_time << 8) | TCNT2;
+    head = next;
+  }
+}
+
+/**
+ * Copy the oldest events into a response buffer.
+ */
+uint8_t trace_drain(uint8_t *buff, uint8_t len) {
+  uint8_t count = 0;
+  uint8_t i = TRACE_HEADER_LEN;
+
+  if (len < TRACE_HEADER_LEN) return 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t pos = tail;
+
+    while (pos != head && i + TRACE_EVENT_SIZE <= len) {
+      buff[i++] = events[pos];
+      buff[i++] = stamps[pos] >> 8;
+      buff[i++] = stamps[pos] & 0xFF;
+      pos = (pos + 1) & TRACE_MASK;
+      count++;
+    }
+
+    seq = (seq == 0xFF) ? 1 : seq + 1;
+    sent = count;
+    dropped_sent = dropped;
+
+    buff[0] = count | (dropped ? 0x80 : 0);
+    buff[1] = seq;
+  }
+
+  return count;
+}
+
+void trace_ack(uint8_t ack_seq) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (ack_seq != 0 && ack_seq == seq) {
+      tail = (tail + sent) & TRACE_MASK;
+      dropped -= dropped_sent;
+      sent = 0;
+      dropped_sent = 0;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * Trace instrumentation, for timing the node with a logic analyzer.
+ *
+ * Build with `make TRACE=1` to enable. Each traced section drives a debug pin
+ * high while it runs and logs its start and end, with a timestamp, into a
+ * small RAM ring that the master can drain with CMD_GET_TRACE. Events stay in
+ * the ring until the master acknowledges the response (CMD_ACK_TRACE).
+ * Without TRACE, the macros compile to nothing.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+// Traced events
+#define TRACE_RX_ISR   0x01 // UART receive interrupt
+#define TRACE_PARSE    0x02 // MultidropSlave::parse, for one byte
+#define TRACE_RESPONSE 0x03 // MultidropSlave::sendResponse
+#define TRACE_SENSE    0x04 // qt_measure_sensors
+#define TRACE_LOOP     0x05 // Start of a main loop iteration (log only, no pin)
+
+// Set on the event ID for the end of a section
+#define TRACE_END_FLAG 0x80
+
+// Debug pins, all on port B (PB3-PB5 are on the ISP header)
+#define TRACE_PORT           PORTB
+#define TRACE_DDR            DDRB
+#define TRACE_PIN_RX_ISR     PB3
+#define TRACE_PIN_PARSE      PB4
+#define TRACE_PIN_RESPONSE   PB5
+#define TRACE_PIN_SENSE      PB0
+
+// Number of events kept (must be a power of 2)
+#ifndef TRACE_LEN
+#define TRACE_LEN 32
+#endif
+
+// Bytes for each drained event: event ID, timestamp (2 bytes)
+#define TRACE_EVENT_SIZE 3
+
+// Size of the header at the start of a drained buffer
+#define TRACE_HEADER_LEN 2
+
+#ifdef TRACE
+
+#define TRACE_BEGIN(ev) do { TRACE_PORT |= (1 << TRACE_PIN_##ev); trace_log(TRACE_##ev); } while (0)
+#define TRACE_END(ev)   do { TRACE_PORT &= ~(1 << TRACE_PIN_##ev); trace_log(TRACE_##ev | TRACE_END_FLAG); } while (0)
+#define TRACE_MARK(ev)  trace_log(TRACE_##ev)
+
+#else
+
+#define TRACE_BEGIN(ev)
+#define TRACE_END(ev)
+#define TRACE_MARK(ev)
+
+#endif
+
+// Set the debug pins as outputs
+void trace_init();
+
+// Choose which events are logged into the ring (bit N = event ID N).
+// Pins are always driven. The RX interrupt is not logged by default, since
+// it fires for every byte on the bus.
+void trace_set_mask(uint8_t mask);
+
+// Log an event with the current timestamp.
+//
+// The timestamp is the low byte of the millisecond clock followed by the
+// Timer 2 count within that millisecond (12.8us per tick at 20MHz).
+void trace_log(uint8_t event);
+
+// Copy as many of the oldest events as fit into `buff`. They stay in the ring,
+// and are sent again, until trace_ack() with this response's sequence number.
+//
+// Format:
+//   [0]    Number of events that follow. Bit 7 is set if events were
+//          dropped because the ring was full.
+//   [1]    Sequence number of this response (never 0).
+//   [2..]  3 bytes per event: event ID (bit 7 set for the end of a section),
+//          millisecond low byte, Timer 2 count.
+//
+// Returns the number of events copied.
+uint8_t trace_drain(uint8_t *buff, uint8_t len);
+
+// The master received the response with this sequence number, so remove the
+// events it had. Anything else (an older response, or 0) is ignored.
+void trace_ack(uint8_t seq);
+
+#endif
@@ -75,7 +75,11 @@ export const CMD = {
 
   SET_COLOR:        0xA1,
   RUN_SENSOR:       0xA2,
-  GET_SENSOR_VALUE: 0xA3
+  GET_SENSOR_VALUE: 0xA3,
+  SET_SENSE_SLOT:   0xA6,
+  SENSE_SYNC:       0xA7,
+  SET_POSITION:     0xD0,
+  DRAW_SHAPE:       0xD1
 };
 
 // Message flags
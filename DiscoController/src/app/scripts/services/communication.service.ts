@@ -32,6 +32,8 @@ import { StorageService } from '../services/storage.service';
 const BAUD_RATE       = 250000;
 const CMD_LOOP_DELAY  = 1;    // Milliseconds between commands
 const SENSOR_DELAY    = 20;   // Delay after the sensor check command (milliseconds)
+const SENSE_SLOTS     = 4;    // Sensing slots per cycle (see _runSensors)
+const SENSE_SLOT_TIME = 4;    // Length of each sensing slot (milliseconds)
 
 @Injectable()
 export class CommunicationService {
@@ -44,7 +46,8 @@ export class CommunicationService {
   private _serialPortLib:any;
   private _running:boolean = false;
   private _runIteration:number = 0;
-  private _sensorSelect:number = 1;
+  private _sensorSlotsSent:boolean = false;
+  private _positionsSent:boolean = false;
   
   bus:BusProtocolService;
 
@@ -223,6 +226,8 @@ export class CommunicationService {
 
     this._running = true;
     this._runIteration = 0;
+    this._sensorSlotsSent = false;
+    this._positionsSent = false;
     this._runThread();
 
     // Frame per second counter
@@ -345,7 +350,7 @@ export class CommunicationService {
 
     switch (this._runIteration) {
       case 0: // Colors
-        subject = this._sendColors();
+        subject = (this._positionsSent) ? this._sendColors() : this._sendPositions();
         break;
       case 1: // Run sensors
         if (!this.sensorsEnabled) return runNext(10);
@@ -423,20 +428,49 @@ export class CommunicationService {
     return this.bus.endMessage();
   }
 
+  /**
+   * Tell each node where it is on the floor grid, so it can draw shapes on its own.
+   */
+  private _sendPositions(): Observable<any> {
+    this.bus.startMessage(CMD.SET_POSITION, 2, { batchMode: true });
+
+    for (let cell of this._floorBuilder.cellList) {
+      this.bus.sendData([cell.x, cell.y]);
+    }
+    this._positionsSent = true;
+
+    return this.bus.endMessage();
+  }
+
   /**
    * Ask all nodes to check their touch sensors.
+   * 
+   * Each node measures in its own slot after this sync message, so neighboring 
+   * cells never measure at the same time (which causes parasitic capacitance),
+   * but every cell still gets measured each frame.
    */
   private _runSensors(): Observable<any> {
-    this.bus.startMessage(CMD.RUN_SENSOR, 1, { batchMode: true });
-
-    // Only ask half the cells checking their sensors at a time
-    // this will hopefully prevent as much parasitic capacitance
-    let even = (this._sensorSelect > 0);
-    for (let i = 0; i < this.bus.nodeNum; i++) {
-      let val = (i % 2 == 0 && even) ? 1 : 0;
-      this.bus.sendData(val);
+    if (!this._sensorSlotsSent) {
+      return this._sendSensorSlots();
+    }
+
+    this.bus.startMessage(CMD.SENSE_SYNC, 2);
+    this.bus.sendData([SENSE_SLOT_TIME, SENSE_SLOTS]);
+    return this.bus.endMessage();
+  }
+
+  /**
+   * Assign each cell a sensing slot based on its position, so that no two 
+   * touching cells (including diagonals) share the same slot.
+   */
+  private _sendSensorSlots(): Observable<any> {
+    this.bus.startMessage(CMD.SET_SENSE_SLOT, 1, { batchMode: true });
+
+    for (let cell of this._floorBuilder.cellList) {
+      let slot = (cell.x % 2) + (cell.y % 2) * 2;
+      this.bus.sendData(slot);
     }
-    this._sensorSelect *= -1;
+    this._sensorSlotsSent = true;
 
     return this.bus.endMessage();
   }